@@ -1,21 +1,61 @@
 #pragma once
 
+#include <algorithm>
 #include <array>
 #include <bit>
 #include <bitset>
+#include <chrono>
 #include <cstddef>
 #include <cstdint>
+#include <deque>
 #include <functional>
 #include <iostream>
 #include <limits>
+#include <memory>
+#include <memory_resource>
+#include <new>
+#include <optional>
 #include <span>
 #include <stdexcept>
 #include <string>
+#include <string_view>
 #include <unordered_map>
+#include <utility>
 #include <vector>
 
-namespace tri {
+// Everything lives in an inline namespace named after the word layout, so
+// code built for one layout can't link against the other by mistake.
+#ifdef TRI_WIDE_WORDS
+#define TRI_LAYOUT wide
+#else
+#define TRI_LAYOUT narrow
+#endif
+
+namespace tri::inline TRI_LAYOUT {
 using uchar = unsigned char;
+
+// Small fixed tables that can be looked up at compile time. Linear search is
+// fine, none of them have more than a few dozen entries.
+template <typename K, typename V, size_t N> struct ConstMap {
+  std::array<std::pair<K, V>, N> entries;
+  constexpr auto begin() const noexcept { return entries.begin(); }
+  constexpr auto end() const noexcept { return entries.end(); }
+  constexpr size_t size() const noexcept { return N; }
+  constexpr auto find(const K &key) const noexcept {
+    return std::find_if(begin(), end(),
+                        [&](auto &entry) { return entry.first == key; });
+  }
+  constexpr bool contains(const K &key) const noexcept {
+    return find(key) != end();
+  }
+  constexpr const V &at(const K &key) const {
+    auto entry = find(key);
+    if (entry == end())
+      throw std::out_of_range("key is not in table");
+    return entry->second;
+  }
+};
+
 // Buffers are always allocated
 enum struct InstructionType : uchar {
 // this is easily the most cursed shit I've ever done
@@ -24,19 +64,25 @@ enum struct InstructionType : uchar {
 #undef X
 };
 
-std::unordered_map<std::string_view, InstructionType> const instruction_table =
-    {
+constexpr size_t instruction_count = 0
+#define X(a) +1
+#include "tri/detail/InstructionMacros"
+#undef X
+    ;
+
+constexpr ConstMap<std::string_view, InstructionType, instruction_count>
+    instruction_table = {{{
 #define X(a) {#a, InstructionType::a},
 #include "tri/detail/InstructionMacros"
 #undef X
-};
+    }}};
 
-std::unordered_map<InstructionType, std::string_view> const instruction_names =
-    {
+constexpr ConstMap<InstructionType, std::string_view, instruction_count>
+    instruction_names = {{{
 #define X(a) {InstructionType::a, #a},
 #include "tri/detail/InstructionMacros"
 #undef X
-};
+    }}};
 
 enum struct Register : uchar {
 #define X(a) a,
@@ -44,11 +90,31 @@ enum struct Register : uchar {
 #undef X
 };
 
-std::unordered_map<std::string_view, Register> const register_table = {
+constexpr size_t register_count = 0
+#define X(a) +1
+#include "tri/detail/RegisterMacros"
+#undef X
+    ;
+
+// v0 - v7 hold lanes of Vals, only the vector instructions take them
+constexpr bool isVector(Register r) noexcept { return r >= Register::v0; }
+constexpr size_t vector_count = register_count - size_t(Register::v0);
+constexpr size_t lane_count = 8;
+using Lanes = std::array<uint32_t, lane_count>;
+
+constexpr ConstMap<std::string_view, Register, register_count>
+    register_table = {{{
 #define X(a) {#a, Register::a},
 #include "tri/detail/RegisterMacros"
 #undef X
-};
+    }}};
+
+constexpr ConstMap<Register, std::string_view, register_count>
+    register_names = {{{
+#define X(a) {Register::a, #a},
+#include "tri/detail/RegisterMacros"
+#undef X
+    }}};
 
 enum struct Type : uchar { reg, lit };
 struct RegisterOperand {
@@ -67,15 +133,28 @@ struct Literal {
     convert(val);
     return *this;
   }
-  operator uint32_t() const noexcept { return std::rotr(value, rotate); }
+  // rotate counts nibbles, so a single hex digit can sit anywhere in the word
+  constexpr operator uint32_t() const noexcept {
+    return std::rotr(uint32_t(value), rotate * 4);
+  }
+  constexpr static bool fits(uint32_t val) noexcept {
+    return rotation(val) >= 0;
+  }
 
 private:
-  void convert(uint32_t val) {
-    if (val < (1 << 4)) {
-      value = val;
-      rotate = 0;
-    } else
-      throw std::logic_error("have not implemented figuring out rotations yet");
+  constexpr static int rotation(uint32_t val) noexcept {
+    for (int r = 0; r != 8; ++r) {
+      if (std::rotl(val, r * 4) < (1u << 4))
+        return r;
+    }
+    return -1;
+  }
+  constexpr void convert(uint32_t val) {
+    auto r = rotation(val);
+    if (r < 0)
+      throw std::logic_error("literal has no rotation that encodes it");
+    rotate = r;
+    value = std::rotl(val, r * 4);
   }
 };
 
@@ -83,19 +162,32 @@ struct [[gnu::packed]] WideLiteral {
   Type type : 1 = Type::lit;
   uint16_t value : 15;
   uint8_t rotate;
-  WideLiteral() = default;
+  constexpr WideLiteral() = default;
   constexpr WideLiteral(Literal l) noexcept
-      : value(l.value), rotate(l.rotate) {}
+      : value(l.value), rotate(l.rotate * 4) {}
   constexpr WideLiteral(uint32_t val) { convert(val); }
-  operator uint32_t() const noexcept { return std::rotr(value, rotate); }
+  // rotate counts bits here, the value is still rotated within 32 bits
+  constexpr operator uint32_t() const noexcept {
+    return std::rotr(uint32_t(value), rotate);
+  }
+  constexpr static bool fits(uint32_t val) noexcept {
+    return rotation(val) >= 0;
+  }
 
 private:
-  void convert(uint32_t val) {
-    if (val < std::numeric_limits<decltype(value)>::max()) {
-      value = val;
-      rotate = 0;
-    } else
-      throw std::logic_error("have not implemented figuring out rotations yet");
+  constexpr static int rotation(uint32_t val) noexcept {
+    for (int r = 0; r != 32; ++r) {
+      if (std::rotl(val, r) < (1u << 15))
+        return r;
+    }
+    return -1;
+  }
+  constexpr void convert(uint32_t val) {
+    auto r = rotation(val);
+    if (r < 0)
+      throw std::logic_error("literal has no rotation that encodes it");
+    value = std::rotl(val, r);
+    rotate = r;
   }
 };
 static_assert(sizeof(WideLiteral) == 3, "WideLiteral is not packed");
@@ -103,14 +195,15 @@ static_assert(sizeof(WideLiteral) == 3, "WideLiteral is not packed");
 struct [[gnu::packed]] SemiLiteral {
   Type type : 1 = Type::lit;
   uint16_t value : 15;
-  SemiLiteral() = default;
-  constexpr SemiLiteral(Literal l) noexcept : value(l) {}
+  constexpr SemiLiteral() = default;
+  constexpr SemiLiteral(Literal l) { convert(l); }
   constexpr SemiLiteral(uint32_t val) { convert(val); }
-  operator uint32_t() const noexcept { return value; }
+  constexpr operator uint32_t() const noexcept { return value; }
+  constexpr static bool fits(uint32_t val) noexcept { return val < (1 << 15); }
 
 private:
-  void convert(uint32_t val) {
-    if (val < (1 << 15)) {
+  constexpr void convert(uint32_t val) {
+    if (fits(val)) {
       value = val;
     } else
       throw std::logic_error("literal is out of bounds");
@@ -125,7 +218,9 @@ union Operand {
 union SemiwideOperand {
   SemiLiteral lit;
   RegisterOperand reg;
-  SemiwideOperand() : lit(0) {}
+  constexpr SemiwideOperand() : lit(0) {}
+  constexpr SemiwideOperand(SemiLiteral l) : lit(l) {}
+  constexpr SemiwideOperand(RegisterOperand r) : reg(r) {}
   constexpr SemiwideOperand(Operand o) {
     if (o.lit.type == Type::lit) {
       lit = o.lit;
@@ -138,7 +233,9 @@ union SemiwideOperand {
 union WideOperand {
   WideLiteral lit;
   RegisterOperand reg;
-  WideOperand() : lit() {}
+  constexpr WideOperand() : lit() {}
+  constexpr WideOperand(WideLiteral l) : lit(l) {}
+  constexpr WideOperand(RegisterOperand r) : reg(r) {}
   constexpr WideOperand(Operand o) {
     if (o.lit.type == Type::lit) {
       lit = o.lit;
@@ -150,7 +247,7 @@ union WideOperand {
 
 struct TriOps {
   Operand a, b;
-  Register out : 4;
+  Register out : 5;
 };
 
 struct [[gnu::packed]] BiOps {
@@ -166,13 +263,23 @@ union Op {
 
 enum struct opCount : unsigned char { zero, one, two, three };
 
-inline opCount operandCount(InstructionType i) noexcept {
+constexpr opCount operandCount(InstructionType i) noexcept {
   using enum opCount;
   switch (i) {
   case InstructionType::subi:
   case InstructionType::muli:
   case InstructionType::divi:
   case InstructionType::addi:
+  case InstructionType::mcpy:
+  case InstructionType::mset:
+  case InstructionType::mcmp:
+  case InstructionType::realloc:
+  case InstructionType::vadd:
+  case InstructionType::vsub:
+  case InstructionType::vmul:
+  case InstructionType::vmin:
+  case InstructionType::vmax:
+  case InstructionType::vcmp:
     return three;
   case InstructionType::mov:
   case InstructionType::load:
@@ -180,18 +287,53 @@ inline opCount operandCount(InstructionType i) noexcept {
   case InstructionType::alloc:
   case InstructionType::jnz:
   case InstructionType::jez:
+  case InstructionType::ldc:
+  case InstructionType::recv:
+  case InstructionType::send:
+  case InstructionType::vld:
+  case InstructionType::vst:
+  case InstructionType::vset:
+  case InstructionType::vsum:
+  case InstructionType::vhmin:
+  case InstructionType::vhmax:
     return two;
   case InstructionType::out:
   case InstructionType::jmp:
   case InstructionType::call:
   case InstructionType::in:
+  case InstructionType::push:
+  case InstructionType::pop:
+  case InstructionType::enter:
     return one;
   case InstructionType::hlt:
   case InstructionType::noop:
+  case InstructionType::leave:
+  case InstructionType::ret:
     return zero;
   }
 }
 
+// the instructions that take v0 - v7 as operands
+constexpr bool isVectorInstruction(InstructionType i) noexcept {
+  switch (i) {
+  case InstructionType::vadd:
+  case InstructionType::vsub:
+  case InstructionType::vmul:
+  case InstructionType::vmin:
+  case InstructionType::vmax:
+  case InstructionType::vcmp:
+  case InstructionType::vld:
+  case InstructionType::vst:
+  case InstructionType::vset:
+  case InstructionType::vsum:
+  case InstructionType::vhmin:
+  case InstructionType::vhmax:
+    return true;
+  default:
+    return false;
+  }
+}
+
 inline opCount count(unsigned i) {
   using enum opCount;
   if (i == 0)
@@ -206,63 +348,94 @@ inline opCount count(unsigned i) {
 }
 struct Instruction {
   InstructionType instruct : 6;
-  int reserved : 2;
+  int reserved : 2 = 0;
   Op op;
-  Instruction(InstructionType type, TriOps o)
+  constexpr Instruction(InstructionType type, TriOps o)
       : instruct(type), op{.ternary = o} {
     if (operandCount(type) != opCount::three) {
       throw std::logic_error("non-unary operator is given too many operands.");
     }
   }
-  Instruction(InstructionType type, BiOps o) : instruct(type), op{.binary = o} {
+  constexpr Instruction(InstructionType type, BiOps o)
+      : instruct(type), op{.binary = o} {
     if (operandCount(type) != opCount::two) {
       throw std::logic_error("non-unary operator is given too many operands.");
     }
   }
-  Instruction(InstructionType type, WideOperand o)
+  constexpr Instruction(InstructionType type, WideOperand o)
       : instruct(type), op{.unary = o} {
     if (operandCount(type) != opCount::one) {
       throw std::logic_error("uninary operator is given too many operands.");
     }
   }
-  Instruction(InstructionType type) : instruct(type), op{} {
+  constexpr Instruction(InstructionType type) : instruct(type), op{} {
     if (operandCount(type) != opCount::zero) {
       throw std::logic_error("uninary operator is given too many operands.");
     }
   }
 };
 
-struct Val {
-  Val() = default;
-  Val(uint32_t i) : data(i) {}
-  uint32_t data : 31;
+// How a Word is laid out. Narrow words are 32 bits: 31 bit values, or 16
+// bit object numbers with 15 bit offsets. Wide words are 64 bits: 63 bit
+// values, or 32 bit object numbers with 31 bit offsets. Defining
+// TRI_WIDE_WORDS when building picks the wide layout for the whole library.
+struct NarrowWords {
+  using Data = uint32_t;
+  using Number = uint16_t;
+  using Offset = uint16_t;
+  static constexpr unsigned data_bits = 31;
+  static constexpr unsigned number_bits = 16;
+  static constexpr unsigned offset_bits = 15;
+};
+
+struct WideWords {
+  using Data = uint64_t;
+  using Number = uint32_t;
+  using Offset = uint32_t;
+  static constexpr unsigned data_bits = 63;
+  static constexpr unsigned number_bits = 32;
+  static constexpr unsigned offset_bits = 31;
+};
+
+#ifdef TRI_WIDE_WORDS
+using WordPolicy = WideWords;
+#else
+using WordPolicy = NarrowWords;
+#endif
+
+template <typename P> struct BasicVal {
+  using Data = typename P::Data;
+  constexpr BasicVal() = default;
+  constexpr BasicVal(Data i) : data(i) {}
+  Data data : P::data_bits;
   bool is_alloc : 1 = false;
-  Val &operator=(uint32_t d) {
+  BasicVal &operator=(Data d) {
     data = d;
     return *this;
   }
-  operator uint32_t() const { return data; }
+  operator Data() const { return data; }
 };
 
-inline bool operator==(Val l, Val r) {
-  return l.is_alloc == r.is_alloc && l.data == r.data;
-}
-
-struct Alloc {
-  Alloc() = default;
-  Alloc(uint16_t num, uint16_t offset) : number(num), offset(offset) {}
-  uint16_t number : 16;
-  uint16_t offset : 15;
+template <typename P> struct BasicAlloc {
+  using Number = typename P::Number;
+  using Offset = typename P::Offset;
+  constexpr BasicAlloc() = default;
+  constexpr BasicAlloc(Number num, Offset offset)
+      : number(num), offset(offset) {}
+  Number number : P::number_bits;
+  Offset offset : P::offset_bits;
   bool is_alloc : 1 = true;
 };
 
-union Word {
+template <typename P> union BasicWord {
+  using Val = BasicVal<P>;
+  using Alloc = BasicAlloc<P>;
   Alloc alloc;
   Val val;
-  Word() : val(0) {}
-  Word(Alloc a) : alloc(a) {}
-  Word(Val v) : val(v) {}
-  Word &operator=(Word other) {
+  constexpr BasicWord() : val(0) {}
+  constexpr BasicWord(Alloc a) : alloc(a) {}
+  constexpr BasicWord(Val v) : val(v) {}
+  BasicWord &operator=(BasicWord other) {
     if (other.alloc.is_alloc)
       alloc = other.alloc;
     else
@@ -270,11 +443,11 @@ union Word {
     return *this;
   }
 
-  Word &operator=(Alloc other) {
+  BasicWord &operator=(Alloc other) {
     alloc = other;
     return *this;
   }
-  Word &operator=(Val other) {
+  BasicWord &operator=(Val other) {
     val = other;
     return *this;
   }
@@ -289,6 +462,16 @@ union Word {
     return val;
   }
 };
+static_assert(sizeof(BasicWord<NarrowWords>) == 4);
+static_assert(sizeof(BasicWord<WideWords>) == 8);
+
+using Val = BasicVal<WordPolicy>;
+using Alloc = BasicAlloc<WordPolicy>;
+using Word = BasicWord<WordPolicy>;
+
+inline bool operator==(Val l, Val r) {
+  return l.is_alloc == r.is_alloc && l.data == r.data;
+}
 
 struct Nullword_t {};
 constexpr inline static Nullword_t nullw;
@@ -316,9 +499,9 @@ template <typename Op> Word WordOps(Op op, Word left, Word right) {
   }
   throw std::runtime_error("tried operating on two alloc operands");
 }
-// the int cast exists because of ambiguous addition operators
+// the Data cast exists because of ambiguous addition operators
 inline auto operator+(Word l, Word r) {
-  return WordOps([](auto l, auto r) { return int(l) + r; }, l, r);
+  return WordOps([](auto l, auto r) { return Val::Data(l) + r; }, l, r);
 }
 
 inline auto operator-(Word left, Word right) {
@@ -328,7 +511,7 @@ inline auto operator-(Word left, Word right) {
     else
       return Word(Alloc(right.alloc.number, right.alloc.offset - left.val));
   } else if (!left.val.is_alloc && !right.val.is_alloc) {
-    return Word(Val(unsigned(left.val) - right.val));
+    return Word(Val(Val::Data(left.val) - right.val));
   }
   return Word(Val(left.alloc.offset - right.alloc.offset));
 }
@@ -341,69 +524,742 @@ template <typename Op> Word WordValOps(Op op, Word left, Word right) {
 }
 
 inline auto operator*(Word l, Word r) {
-  return WordValOps([](auto l, auto r) { return int(l) + r; }, l, r);
+  return WordValOps([](auto l, auto r) { return Val::Data(l) + r; }, l, r);
 }
 inline auto operator/(Word l, Word r) {
-  return WordValOps([](auto l, auto r) { return int(l) - r; }, l, r);
+  return WordValOps([](auto l, auto r) { return Val::Data(l) - r; }, l, r);
 }
 
+// how the assembler encoded each literal operand
+struct LiteralStats {
+  size_t direct = 0;  // fit without rotation
+  size_t rotated = 0; // needed a rotation to fit
+  size_t pooled = 0;  // went to the literal pool and is loaded with ldc
+};
+
+// what the optimizer did to a program, counted in instructions
+struct OptimizeStats {
+  size_t before = 0;
+  size_t after = 0;
+  size_t folded = 0;      // arithmetic and branches on known constants
+  size_t propagated = 0;  // register operands replaced by constants or copies
+  size_t dead = 0;        // register writes that are never read
+  size_t unreachable = 0; // code no path reaches
+  size_t threaded = 0;    // jumps retargeted past other jumps
+};
+
+// how often load and store found their object without a heap lookup
+struct HeapCacheStats {
+  size_t hits = 0;
+  size_t misses = 0;
+  double hit_rate() const noexcept {
+    return hits + misses == 0 ? 0 : double(hits) / double(hits + misses);
+  }
+};
+
+// what the tracing tier did, see Interpreter::enable_tracing
+struct TraceStats {
+  size_t recorded = 0;     // loops that got a trace
+  size_t aborted = 0;      // recordings given up on
+  size_t entered = 0;      // times a trace was run
+  size_t loop_exits = 0;   // the loop's test at its head or back edge ending it
+  size_t side_exits = 0;   // other guards that sent a trace back
+  size_t discarded = 0;    // traces dropped for failing their guards
+  size_t instructions = 0; // instructions run inside traces
+  // only added up when tracing is timed
+  std::chrono::nanoseconds time{};
+};
+
 struct Executable {
   std::vector<Word> data;
   std::vector<Instruction> text;
+  LiteralStats literals;
+  OptimizeStats optimized;
+  // label name -> address in text
+  std::unordered_map<std::string, uint32_t> labels;
+};
+
+// optimize runs constant folding, copy propagation, dead code elimination
+// and jump threading before the program is encoded
+Executable assemble(const char *data, const char *assembly,
+                    bool optimize = false);
+
+// Checks that every register operand names a register, that operands which
+// must be registers are, that nothing but a jump writes ip, and that every
+// literal jump target is inside text. Only register jumps and memory accesses
+// are left to be checked while running.
+bool verify(std::span<const Instruction> text) noexcept;
+
+class Interpreter;
+
+// An assembled program that any number of Interpreters can run at once.
+// Copies share one image, which never changes once built. VMs made from it
+// don't copy its text, labels or data. The data is kept in pages, and a VM
+// only copies a page the first time it writes to it.
+class Program {
+public:
+  static constexpr size_t page_words = 512;
+  // verifies text once for every VM made from the program
+  explicit Program(Executable &&);
+  std::span<const Instruction> text() const noexcept { return image->text; }
+  const std::unordered_map<std::string, uint32_t> &labels() const noexcept {
+    return image->labels;
+  }
+  size_t data_words() const noexcept { return image->dataWords; }
+  bool verified() const noexcept { return image->verified; }
+
+private:
+  friend class Interpreter;
+  using Page = std::shared_ptr<std::vector<Word>>;
+  struct Image {
+    std::vector<Instruction> text;
+    std::unordered_map<std::string, uint32_t> labels;
+    // only the last page can be short
+    std::vector<Page> pages;
+    size_t dataWords = 0;
+    bool verified = false;
+    // assembled with the optimizer, which doesn't know about trap handlers
+    bool optimized = false;
+  };
+  std::shared_ptr<const Image> image;
+  Program() = default;
+};
+
+// which kernels the vector instructions run on: "avx2", "sse4.1" or "scalar",
+// picked for the cpu the first time they are used
+const char *lane_implementation() noexcept;
+
+enum struct TrapCode : uchar {
+  none,
+  invalid_instruction, // opcode that doesn't exist
+  invalid_register,    // register operand that doesn't exist
+  operand_type,        // literal where a register is needed
+  ip_range,            // ip is outside of text
+  jump_range,          // register jump target is outside of text
+  invalid_deref,       // pointer to a freed object or past its end
+  alloc_arithmetic,    // arithmetic that can't take alloc operands
+  invalid_port,        // recv or send on a port the host never opened
+  memory_quota,        // alloc, realloc or stack growth past the Limits
+};
+
+// what went wrong, at which instruction, and the operands involved
+struct Trap {
+  TrapCode code = TrapCode::none;
+  Val::Data ip = 0;
+  Word a, b;
+};
+
+// suspended means the guest read an empty channel or wrote a full one
+enum struct Status : uchar { halted, trapped, suspended };
+
+// A ring buffer of words between the host and the guest. The host fills and
+// drains it in bulk, the guest moves one word per instruction and suspends
+// instead of blocking.
+class Channel {
+  std::vector<uint32_t> buffer;
+  // read and write positions, these only ever grow and are masked on use
+  size_t head = 0, tail = 0;
+  size_t mask() const noexcept { return buffer.size() - 1; }
+
+public:
+  static constexpr size_t default_capacity = 256;
+  // rounded up to a power of two
+  explicit Channel(size_t capacity = default_capacity)
+      : buffer(std::bit_ceil(std::max<size_t>(capacity, 1))) {}
+
+  size_t size() const noexcept { return tail - head; }
+  size_t capacity() const noexcept { return buffer.size(); }
+  bool empty() const noexcept { return head == tail; }
+  bool full() const noexcept { return size() == capacity(); }
+
+  bool push(uint32_t word) noexcept {
+    if (full())
+      return false;
+    buffer[tail++ & mask()] = word;
+    return true;
+  }
+  bool pop(uint32_t &word) noexcept {
+    if (empty())
+      return false;
+    word = buffer[head++ & mask()];
+    return true;
+  }
+
+  // The queued words up to where the buffer wraps, so draining everything
+  // takes at most two peek/consume rounds. Valid until the next write.
+  std::span<const uint32_t> peek() const noexcept {
+    auto start = head & mask();
+    return {buffer.data() + start, std::min(size(), capacity() - start)};
+  }
+  void consume(size_t n) noexcept { head += std::min(n, size()); }
+  // free space up to where the buffer wraps, commit says how much of it was
+  // written
+  std::span<uint32_t> reserve() noexcept {
+    auto start = tail & mask();
+    return {buffer.data() + start,
+            std::min(capacity() - size(), capacity() - start)};
+  }
+  void commit(size_t n) noexcept { tail += std::min(n, capacity() - size()); }
+
+  // copying versions of the above, return how many words were moved
+  size_t write(std::span<const uint32_t> words) noexcept {
+    size_t done = 0;
+    for (auto space = reserve(); done != words.size() && !space.empty();
+         space = reserve()) {
+      auto n = std::min(space.size(), words.size() - done);
+      std::copy_n(words.begin() + done, n, space.begin());
+      commit(n);
+      done += n;
+    }
+    return done;
+  }
+  size_t read(std::span<uint32_t> words) noexcept {
+    size_t done = 0;
+    for (auto queued = peek(); done != words.size() && !queued.empty();
+         queued = peek()) {
+      auto n = std::min(queued.size(), words.size() - done);
+      std::copy_n(queued.begin(), n, words.begin() + done);
+      consume(n);
+      done += n;
+    }
+    return done;
+  }
+  // everything queued, a char per word, for guests that write text
+  std::string read_text() {
+    std::string text;
+    for (auto queued = peek(); !queued.empty(); queued = peek()) {
+      for (auto c : queued)
+        text += char(c);
+      consume(queued.size());
+    }
+    return text;
+  }
+};
+
+// in is what the guest reads, out is what it writes
+struct Port {
+  Channel in, out;
+};
+
+// the channel a suspended guest is waiting on
+struct Suspension {
+  uint32_t port = 0;
+  // waiting for out to be drained rather than in to be filled
+  bool output = false;
 };
 
-Executable assemble(const char *data, const char *assembly);
+// Memory budgets for one VM, going over one traps with memory_quota. The
+// defaults are what the word layout can address: every object number, each
+// as long as an offset reaches, and a stack as long as one object.
+struct Limits {
+  // words past this can't be addressed, so no object is ever longer
+  static constexpr size_t object_words = size_t(1) << WordPolicy::offset_bits;
+  size_t heap_words = object_words << WordPolicy::number_bits;
+  size_t objects = size_t(1) << WordPolicy::number_bits;
+  size_t stack_words = object_words;
+  // alloc runs clean() once before giving up
+  bool collect = true;
+};
+
+// One step from a root to a sampled object. A run of objects from the same
+// site, or of unsampled ones, is a single step.
+struct RetentionStep {
+  // "r5", "stack 3" or "data 12" for the root, then a site or "unsampled"
+  std::string what;
+  size_t objects = 0; // 0 for the root
+};
+
+// an alloc instruction's share of the heap, judged from its samples
+struct SiteProfile {
+  uint32_t ip = 0;
+  // the closest label at or before ip, "loop+3" say
+  std::string where;
+  size_t sampled = 0; // objects sampled here since profiling started
+  size_t live = 0;    // sampled objects that are still alive
+  // estimated words in every live object from here, sampled or not
+  double live_words = 0;
+  // sampled objects that lived through the first clean() after they were
+  // made, out of those that have been through one
+  size_t survived = 0;
+  size_t collected = 0;
+  // clean()s the oldest live sample has lived through
+  uint64_t oldest = 0;
+  // how the biggest live sample from here, the oldest if several are as
+  // big, is reached, root first
+  std::vector<RetentionStep> path;
+  double survival_rate() const noexcept {
+    return collected == 0 ? 0 : double(survived) / double(collected);
+  }
+};
+
+// the heap as heap profiling saw it at the end of the last clean()
+struct HeapProfile {
+  // clean()s since profiling started, objects are born in one of them
+  uint64_t collections = 0;
+  double live_words = 0;
+  // most live words first
+  std::vector<SiteProfile> sites;
+  // a few lines per site
+  std::string dump() const;
+};
+
+// see Interpreter::profile_heap
+struct HeapProfiling {
+  // on average one object is sampled per this many words allocated, 1
+  // samples every object
+  size_t sample_words = 1024;
+  // called at the end of every clean() with the new profile
+  std::function<void(const HeapProfile &)> on_clean;
+};
+
+// a word the guest read or wrote
+struct IoEvent {
+  // instructions run since recording started, counting the one that did it
+  uint64_t at = 0;
+  uint32_t port = 0;
+  bool output = false;
+  uint32_t value = 0;
+  bool operator==(const IoEvent &) const = default;
+};
+
+// Everything a run read and wrote, in order. Interpreter::record fills one
+// in and Interpreter::replay runs a VM against it.
+class IoLog {
+  std::vector<IoEvent> log;
+
+public:
+  void push(const IoEvent &e) { log.push_back(e); }
+  std::span<const IoEvent> events() const noexcept { return log; }
+  void clear() noexcept { log.clear(); }
+  // the gaps between events' instruction counts, ports and values as
+  // LEB128, a few bytes an event
+  std::vector<std::byte> encode() const;
+  static IoLog decode(std::span<const std::byte> bytes);
+};
+
+// how a replay went
+struct ReplayReport {
+  Status status = Status::halted;
+  // events that happened as logged before the first that didn't
+  size_t matched = 0;
+  // an event differed, or one run had events the other didn't
+  bool diverged = false;
+};
 
 class Interpreter final {
+  using Words = std::pmr::vector<Word>;
   struct Allocation {
-    uint32_t begin() const noexcept { return 0; }
-    uint32_t end() const noexcept { return data.size(); }
+    size_t begin() const noexcept { return 0; }
+    size_t end() const noexcept { return data->size(); }
     bool inRange(Alloc ptr) const noexcept { return ptr.offset < end(); }
-    Word &deref(uint32_t ptr) { return data.at(ptr); }
-    std::vector<Word> data;
+    // forks share the words until one of them writes
+    std::shared_ptr<Words> data;
     bool mark;
-    Allocation(uint32_t size, bool mark) : mark(mark) { data.resize(size); }
+    Allocation(std::pmr::memory_resource *arena, size_t size, bool mark)
+        : data(std::allocate_shared<Words>(
+              std::pmr::polymorphic_allocator<>(arena), size)),
+          mark(mark) {}
+    Words &own(std::pmr::memory_resource *arena) {
+      if (data.use_count() > 1)
+        data = std::allocate_shared<Words>(
+            std::pmr::polymorphic_allocator<>(arena), *data);
+      return *data;
+    }
+  };
+  using Heap = std::pmr::unordered_map<uint32_t, Allocation>;
+
+  // The heap map and every object in it are allocated from the VM's own
+  // pool. Unless a fork shares its objects, tearing a VM down releases the
+  // pool without visiting a single object.
+  class Arena {
+    struct Pool {
+      std::pmr::unsynchronized_pool_resource resource;
+    };
+    std::shared_ptr<Pool> pool = std::make_shared<Pool>();
+    // the pools of objects shared with the VM this was copied from
+    std::vector<std::shared_ptr<Pool>> borrowed;
+    Heap *map = make();
+
+    Heap *make() {
+      auto r = &pool->resource;
+      return new (r->allocate(sizeof(Heap), alignof(Heap))) Heap(r);
+    }
+
+  public:
+    Arena() = default;
+    Arena(const Arena &other) : borrowed(other.borrowed) {
+      borrowed.push_back(other.pool);
+      *map = *other.map;
+    }
+    Arena(Arena &&other) noexcept
+        : pool(std::move(other.pool)), borrowed(std::move(other.borrowed)),
+          map(std::exchange(other.map, nullptr)) {}
+    Arena &operator=(Arena other) noexcept {
+      std::swap(pool, other.pool);
+      std::swap(borrowed, other.borrowed);
+      std::swap(map, other.map);
+      return *this;
+    }
+    ~Arena() {
+      // objects shared with a fork either way count references into each
+      // other, so those have to be dropped one by one after all
+      if (map && (!borrowed.empty() || pool.use_count() > 1))
+        map->~Heap();
+    }
+    Heap &heap() noexcept { return *map; }
+    const Heap &heap() const noexcept { return *map; }
+    std::pmr::memory_resource *resource() noexcept { return &pool->resource; }
+  };
+  // the object a load or store found last time it ran, valid while epoch
+  // matches the interpreter's
+  struct HeapSite {
+    uint32_t number = 0;
+    uint64_t epoch = 0;
+    Allocation *alloc = nullptr;
+  };
+  // one site per instruction. They point into the heap they were filled
+  // from, so copies start out empty.
+  struct HeapSites : std::vector<HeapSite> {
+    using std::vector<HeapSite>::vector;
+    HeapSites(const HeapSites &other) : std::vector<HeapSite>(other.size()) {}
+    HeapSites(HeapSites &&) = default;
+    HeapSites &operator=(const HeapSites &other) {
+      assign(other.size(), {});
+      return *this;
+    }
+    HeapSites &operator=(HeapSites &&) = default;
   };
 
+  // An instruction of a trace. While recording it notes the operand tags and
+  // branch direction it saw, compiling turns those into a specialised kind
+  // that guards on them.
+  struct TraceStep {
+    enum Kind : uchar {
+      generic, // through the interpreter's handlers, checks ip afterwards
+      add_vals,
+      add_ptr, // alloc + val
+      sub_vals,
+      sub_ptr, // alloc - val
+      mov,
+      branch, // jnz/jez to a literal, guards on the recorded direction
+      jump,   // jmp to a literal, nothing left to do
+      call,   // call to a literal, only sets rp
+    };
+    Kind kind = generic;
+    bool a_alloc = false;
+    bool b_alloc = false;
+    bool taken = false;
+    uint32_t at;
+    Instruction instruction;
+  };
+  struct Trace : std::vector<TraceStep> {
+    // runs in a row a guard ended before they got back to the head
+    uint8_t misses = 0;
+  };
+  static constexpr int16_t trace_threshold = 64;
+  static constexpr size_t max_trace = 256;
+  // a trace that misses this often was recorded on tags the loop no longer
+  // has, so it's dropped and the loop recorded again once it's hot
+  static constexpr uint8_t max_misses = 8;
+
+  // Addresses below dataWords are the program's data, in pages shared with
+  // the Program until written. The stack holds the ones above it.
+  std::vector<Program::Page> data;
+  size_t dataWords = 0;
   std::vector<Word> stack;
-  std::unordered_map<uint32_t, Allocation> heap;
+  Arena arena;
+  Limits quota;
+  // words in live heap objects, what Limits::heap_words is checked against
+  size_t heapWords = 0;
   std::vector<std::bitset<64>> allocced = {0};
   std::vector<std::bitset<64>> marks = {0};
-  std::vector<Instruction> text;
+  // where a pointer clean() follows was found: in an object, or in a root
+  struct Via {
+    enum Kind : uint8_t { none, object, reg, stack, data };
+    Kind kind = none;
+    uint32_t index = 0;
+  };
+  // what heap profiling knows about a sampled object
+  struct Sample {
+    uint32_t ip;
+    uint64_t birth;
+    // how many objects like it it stands for
+    double scale;
+  };
+  struct SiteCounts {
+    size_t sampled = 0;
+    size_t survived = 0;
+    size_t collected = 0;
+  };
+  struct Profiler {
+    HeapProfiling options;
+    uint64_t random = 0x9e3779b97f4a7c15;
+    double untilSample = 0;
+    uint64_t collections = 0;
+    // by object number and by ip
+    std::unordered_map<uint32_t, Sample> samples;
+    std::unordered_map<uint32_t, SiteCounts> sites;
+    double nextSample();
+  };
+  std::optional<Profiler> profiler;
+  HeapProfile heapProfile;
+  // keeps the text, labels and data pages alive, text points into it
+  Program program;
+  const std::vector<Instruction> *text = nullptr;
+  // sized to text by execute(), a VM that never runs doesn't pay for them
+  HeapSites sites;
+  // bumped whenever clean() frees something, which drops every site
+  uint64_t epoch = 1;
+  HeapCacheStats cacheStats;
+  // backward jumps taken to each instruction, a failed recording sets it
+  // negative so the loop has to get hot again before the next try
+  std::vector<int16_t> heat;
+  // by loop head
+  std::unordered_map<uint32_t, Trace> traces;
+  // the trace being recorded, empty when not recording
+  Trace recording;
+  bool tracing = true;
+  bool timeTraces = false;
+  // a hot loop head was jumped to or a recorded instruction ran
+  bool traceEvent = false;
+  bool blocked = false;
+  TraceStats traceStats;
   std::array<Word, 16> registers{};
+  // never hold pointers, vld traps on them instead
+  std::array<Lanes, vector_count> vectors{};
   bool debug = false;
+  bool checked = true;
+  Trap trapped;
+  // set by a trap or a suspension, checked once per instruction
+  bool interrupted = false;
+  Suspension waiting;
+  // grows on demand, a deque so the host's references stay valid
+  std::deque<Port> ports = std::deque<Port>(1);
+  // where traps go instead of the host, if the guest has a handler
+  std::optional<uint32_t> handler;
+  // sp when a trap was handed to the handler, until the handler returns
+  std::optional<Val::Data> handling;
+  // stands in for whatever a trapping instruction would have accessed
+  Word sink;
+  Lanes laneSink;
+  // instructions run, a suspended one isn't counted until it's resumed
+  uint64_t retired = 0;
+  IoLog *ioLog = nullptr;
+  // retired when recording started
+  uint64_t ioBase = 0;
 
   auto &ip() { return registers[0]; }
   auto &bp() { return registers[1]; }
   auto &sp() { return registers[2]; }
   auto &rp() { return registers[3]; }
-  auto &reg(Register r) {
-    if (r != Register::invalid)
-      return registers[static_cast<uchar>(r) - 1];
-    else
-      throw std::logic_error("invalid register accessed");
+  // records the first trap of an instruction, the result stands in for the
+  // operand that could not be accessed. It reads as 0, never as a pointer an
+  // earlier trapped store left there
+  Word &raise(TrapCode code, Word a = {}, Word b = {}) noexcept {
+    if (trapped.code == TrapCode::none)
+      trapped = {code, 0, a, b};
+    interrupted = true;
+    sink = Val(0);
+    return sink;
+  }
+  bool deliver(Val::Data at) noexcept;
+  // ret or jmp rp at the depth the handler started at ends it
+  void returned() noexcept {
+    if (handling && sp().val <= *handling) [[unlikely]]
+      handling.reset();
+  }
+  void block(uint32_t port, bool output) noexcept {
+    waiting = {port, output};
+    blocked = interrupted = true;
+  }
+  void logIo(uint32_t port, bool output, uint32_t value) {
+    if (ioLog) [[unlikely]]
+      ioLog->push({retired - ioBase, port, output, value});
+  }
+  Port *guestPort(Word number) noexcept {
+    if (number.val.is_alloc || number.val >= ports.size()) [[unlikely]] {
+      raise(TrapCode::invalid_port, number);
+      return nullptr;
+    }
+    return &ports[number.val];
   }
 
-  auto &reg(Operand o) {
-    if (o.reg.type != Type::reg)
-      throw std::runtime_error("wrong operand access type");
-    return reg(o.reg.operand);
+  // the unchecked variants are only used on text that passed verify()
+  Heap &heap() noexcept { return arena.heap(); }
+  const Heap &heap() const noexcept { return arena.heap(); }
+  // whether the current instruction has trapped so far
+  bool faulted() const noexcept { return trapped.code != TrapCode::none; }
+  // calls f with every pointer in data, the stack up to sp and the
+  // registers, the roots clean() marks from
+  template <typename F> void roots(F &&f) {
+    // any data page may have been written with a pointer
+    uint32_t address = 0;
+    for (auto &page : data) {
+      for (auto w : *page) {
+        if (w.alloc.is_alloc)
+          f(w.alloc, Via{Via::data, address});
+        ++address;
+      }
+    }
+    if (sp().val >= dataWords) {
+      auto top = std::min<size_t>(sp().val + 1 - dataWords, stack.size());
+      for (uint32_t i = 0; i != top; ++i) {
+        if (stack[i].alloc.is_alloc)
+          f(stack[i].alloc, Via{Via::stack, uint32_t(dataWords + i)});
+      }
+    }
+    for (uint32_t i = 0; i != registers.size(); ++i) {
+      if (registers[i].alloc.is_alloc)
+        f(registers[i].alloc, Via{Via::reg, i + 1});
+    }
   }
 
-  Word alloc(uint32_t size);
-  Word &deref(Word ptr);
+  template <bool Checked = true> Word &reg(Register r) noexcept {
+    if constexpr (Checked) {
+      if (r == Register::invalid || static_cast<uchar>(r) > registers.size())
+          [[unlikely]]
+        return raise(TrapCode::invalid_register);
+    }
+    return registers[static_cast<uchar>(r) - 1];
+  }
 
-public:
-  std::function<uint32_t()> in;
-  std::function<void(uint32_t)> out = [](uint32_t i) { std::cout << char(i); };
+  template <bool Checked = true> Lanes &vec(Register r) noexcept {
+    if constexpr (Checked) {
+      if (!isVector(r) || static_cast<size_t>(r) >= register_count)
+          [[unlikely]] {
+        raise(TrapCode::invalid_register);
+        return laneSink;
+      }
+    }
+    return vectors[static_cast<size_t>(r) - size_t(Register::v0)];
+  }
+  template <bool Checked = true, typename O>
+    requires requires(O o) { o.reg.type; }
+  Lanes &vec(O o) noexcept {
+    if constexpr (Checked) {
+      if (o.reg.type != Type::reg) [[unlikely]] {
+        raise(TrapCode::operand_type);
+        return laneSink;
+      }
+    }
+    return vec<Checked>(o.reg.operand);
+  }
+
+  template <bool Checked = true, typename O>
+    requires requires(O o) { o.reg.type; }
+  Word &reg(O o) noexcept {
+    if constexpr (Checked) {
+      if (o.reg.type != Type::reg) [[unlikely]]
+        return raise(TrapCode::operand_type);
+    }
+    return reg<Checked>(o.reg.operand);
+  }
+
+  template <bool Checked> Status run();
+  // what to do after the instruction at `at` raised a trace event, returns
+  // the trace to run if there's one for ip
+  Trace *onTrace(uint32_t at);
+  void recordStep(uint32_t at);
+  void abortRecording();
+  static void compileTrace(Trace &trace);
+  Word alloc(Val::Data size);
+  void sampleAlloc(uint32_t number, size_t words);
+  // runs between marking and sweeping, while the dead are still there
+  void profileClean();
+  // realloc, the object keeps its number and ptr stays valid
+  Word resize(Word ptr, Word size);
+  // only writes unshare a forked allocation
+  template <bool Write> Word &deref(Word ptr);
+  template <bool Write> Word &deref(Word ptr, HeapSite &site);
+  // len words at ptr with a single bounds check, empty if that trapped
+  template <bool Write> std::span<Word> range(Word ptr, Val::Data len);
+  // false if that would go over Limits::stack_words
+  bool grow(size_t size);
+  // a data word, copying its page first if it is written
+  template <bool Write> Word &dataWord(size_t address);
+  // copies every data page into the stack, for ranges that cross pages
+  void flatten();
+  // takes text, labels and data from program, leaves the registers alone
+  void load(const Program &program);
+  Interpreter() = default;
 
+public:
+  Interpreter(const Program &);
   Interpreter(Executable &&);
-  void execute();
-  void enable_debug() noexcept { debug = true; }
+  // Runs until hlt, a trap the guest doesn't handle or a suspension. A
+  // trapped or suspended instruction is left at ip, so fixing things up
+  // (or filling/draining channels) and calling execute() again retries it.
+  Status execute();
+  // in and out use port 0, recv and send take a port number
+  Port &port(size_t number = 0) {
+    if (number >= ports.size())
+      ports.resize(number + 1);
+    return ports[number];
+  }
+  // what the last Status::suspended was waiting on
+  const Suspension &suspension() const noexcept { return waiting; }
+  const Trap &trap() const noexcept { return trapped; }
+  // Traps jump to label with the trapping instruction's address in rp and the
+  // TrapCode in r0. Until the handler returns, with ret or jmp rp at the
+  // stack depth it started at, traps go to the host so a broken handler
+  // can't loop. Optimized text has no handlers, the optimizer doesn't see
+  // the jumps traps make and may delete or move the code a label names.
+  bool trap_handler(std::string_view label);
+  // debug output is per instruction, which traces don't have
+  void enable_debug() noexcept {
+    debug = true;
+    tracing = false;
+  }
+  // Loops that get hot are recorded into traces specialised on the tags
+  // their registers had, which run until a guard fails. On by default.
+  // Timing reads the clock twice per trace run, so it's off by default.
+  void enable_tracing(bool on, bool timed = false) noexcept {
+    tracing = on && !debug;
+    timeTraces = timed;
+  }
+  const TraceStats &trace_stats() const noexcept { return traceStats; }
+  // whether the text passed verify() and runs without per-instruction checks
+  bool verified() const noexcept { return !checked; }
   void clean();
   size_t mem_consumption() const noexcept;
+  const Limits &limits() const noexcept { return quota; }
+  void set_limits(const Limits &limits) noexcept { quota = limits; }
+  const HeapCacheStats &heap_cache_stats() const noexcept {
+    return cacheStats;
+  }
+  // Samples allocations and tags them with the alloc that made them, their
+  // size and the clean() they were born after. Every clean() then updates
+  // heap_profile(). std::nullopt stops profiling.
+  void profile_heap(std::optional<HeapProfiling> options);
+  const HeapProfile &heap_profile() const noexcept { return heapProfile; }
+  uint64_t retired_instructions() const noexcept { return retired; }
+  // Appends every word read or written on any port to log, until called
+  // again with nullptr. The log has to outlive the recording.
+  void record(IoLog *log) noexcept {
+    ioLog = log;
+    ioBase = retired;
+  }
+  // Runs to the end feeding input from log instead of the host, and checks
+  // that every read and write happens at the instruction count it was
+  // logged at. Ports are drained as it goes.
+  ReplayReport replay(const IoLog &log);
+
+  // Registers, vectors, stack, heap and text in a flat byte format that
+  // restore() reads back. Ports and the debug flag aren't part of it.
+  std::vector<std::byte> snapshot() const;
+  static Interpreter restore(std::span<const std::byte> snapshot);
+  // A copy that shares text, data pages and heap objects with this one
+  // until either writes to them. The copy starts with empty ports. A VM and
+  // its forks free objects into each other's pools, which aren't
+  // synchronized, so they all have to stay on one thread.
+  Interpreter fork() const {
+    Interpreter clone = *this;
+    clone.ports = std::deque<Port>(1);
+    clone.ioLog = nullptr;
+    return clone;
+  }
 };
-} // namespace tri
+} // namespace tri::inline TRI_LAYOUT
 
 #ifdef TRI_ENABLE_FMT_FORMATTING
 
@@ -417,9 +1273,9 @@ template <> struct fmt::formatter<tri::Word> {
     // I have to int cast this stuff bc fmt for some reason likes taking
     // const refs of stuff
     if (w.alloc.is_alloc)
-      return fmt::format_to(ctx.out(), "({}, {})", int(w.alloc.number),
-                            int(w.alloc.offset));
-    return fmt::format_to(ctx.out(), "{0:x}", int(w.val.data));
+      return fmt::format_to(ctx.out(), "({}, {})", uint64_t(w.alloc.number),
+                            uint64_t(w.alloc.offset));
+    return fmt::format_to(ctx.out(), "{0:x}", uint64_t(w.val.data));
   }
 };
 #endif
\ No newline at end of file
@@ -0,0 +1,101 @@
+#pragma once
+
+#include "tri/asm.hpp"
+
+#include <coroutine>
+#include <exception>
+#include <optional>
+#include <utility>
+
+namespace tri::inline TRI_LAYOUT {
+namespace detail {
+// hands control back to whoever awaited the task
+struct FinalAwaiter {
+  bool await_ready() noexcept { return false; }
+  template <typename P>
+  std::coroutine_handle<> await_suspend(std::coroutine_handle<P> h) noexcept {
+    return h.promise().continuation;
+  }
+  void await_resume() noexcept {}
+};
+
+struct PromiseBase {
+  std::coroutine_handle<> continuation = std::noop_coroutine();
+  std::exception_ptr error;
+
+  std::suspend_always initial_suspend() noexcept { return {}; }
+  FinalAwaiter final_suspend() noexcept { return {}; }
+  void unhandled_exception() noexcept { error = std::current_exception(); }
+};
+
+template <typename T> struct Promise : PromiseBase {
+  std::optional<T> value;
+  void return_value(T v) { value = std::move(v); }
+  T result() {
+    if (error)
+      std::rethrow_exception(error);
+    return std::move(*value);
+  }
+};
+
+template <> struct Promise<void> : PromiseBase {
+  void return_void() noexcept {}
+  void result() {
+    if (error)
+      std::rethrow_exception(error);
+  }
+};
+} // namespace detail
+
+// A lazily started coroutine. Other coroutines co_await it, plain code calls
+// resume() once to start it and result() after done().
+template <typename T = void> class Task {
+public:
+  struct promise_type : detail::Promise<T> {
+    Task get_return_object() noexcept {
+      return Task(std::coroutine_handle<promise_type>::from_promise(*this));
+    }
+  };
+
+  Task(Task &&other) noexcept : handle(std::exchange(other.handle, {})) {}
+  Task &operator=(Task &&other) noexcept {
+    if (handle)
+      handle.destroy();
+    handle = std::exchange(other.handle, {});
+    return *this;
+  }
+  ~Task() {
+    if (handle)
+      handle.destroy();
+  }
+
+  bool done() const noexcept { return handle.done(); }
+  void resume() { handle.resume(); }
+  T result() { return handle.promise().result(); }
+
+  bool await_ready() const noexcept { return false; }
+  std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) {
+    handle.promise().continuation = awaiting;
+    return handle;
+  }
+  T await_resume() { return handle.promise().result(); }
+
+private:
+  explicit Task(std::coroutine_handle<promise_type> h) noexcept : handle(h) {}
+  std::coroutine_handle<promise_type> handle;
+};
+
+// Runs the interpreter until it halts or traps. Whenever it suspends on a
+// channel, wait(interpreter, suspension) is co_awaited, it should return
+// once that channel has been filled or drained, e.g. after the host's event
+// loop reports the file descriptor behind it as ready. Nothing blocks, so
+// one thread can drive as many interpreters as it has tasks.
+template <typename Wait> Task<Status> run_async(Interpreter &run, Wait wait) {
+  while (true) {
+    auto status = run.execute();
+    if (status != Status::suspended)
+      co_return status;
+    co_await wait(run, run.suspension());
+  }
+}
+} // namespace tri::inline TRI_LAYOUT
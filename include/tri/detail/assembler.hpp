@@ -0,0 +1,476 @@
+#pragma once
+
+#include "tri/asm.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <variant>
+#include <vector>
+
+// The assembler itself. Everything here is constexpr so tri::program can
+// assemble at compile time; tri::assemble runs the same code at runtime.
+namespace tri::inline TRI_LAYOUT::detail {
+// Val only holds 31 bits, so literals are reduced to that before encoding
+constexpr uint32_t literal_mask = (1u << 31) - 1;
+
+// an insertion ordered map for the handful of names a program defines
+template <typename K, typename V> struct Table {
+  std::vector<std::pair<K, V>> entries;
+  constexpr auto begin() noexcept { return entries.begin(); }
+  constexpr auto end() noexcept { return entries.end(); }
+  constexpr auto begin() const noexcept { return entries.begin(); }
+  constexpr auto end() const noexcept { return entries.end(); }
+  template <typename Key> constexpr auto find(const Key &key) {
+    return std::find_if(begin(), end(),
+                        [&](auto &entry) { return entry.first == key; });
+  }
+  template <typename Key> constexpr auto find(const Key &key) const {
+    return std::find_if(begin(), end(),
+                        [&](auto &entry) { return entry.first == key; });
+  }
+  template <typename Key> constexpr bool contains(const Key &key) const {
+    return find(key) != end();
+  }
+  template <typename Key> constexpr const V &at(const Key &key) const {
+    auto entry = find(key);
+    if (entry == end())
+      throw std::out_of_range("name is not defined");
+    return entry->second;
+  }
+  // like std::map, an existing entry is kept
+  constexpr auto insert(const std::pair<K, V> &entry) {
+    auto existing = find(entry.first);
+    if (existing != end())
+      return std::pair{existing, false};
+    entries.push_back(entry);
+    return std::pair{end() - 1, true};
+  }
+  constexpr V &operator[](const K &key) {
+    return insert({key, V{}}).first->second;
+  }
+};
+
+struct UnfinishedInstruction {
+  InstructionType instruct;
+  std::string a, b, out;
+};
+using Code = std::vector<UnfinishedInstruction>;
+// label name -> index of the instruction it points at
+using Labels = Table<std::string, size_t>;
+// data section identifiers -> the value they are substituted with
+using Globals = Table<std::string, size_t>;
+
+// a program after parsing, before any literal is encoded
+struct Source {
+  std::vector<Word> data;
+  Globals globals;
+  Code code;
+  Labels labels;
+};
+
+struct Assembled {
+  std::vector<Word> data;
+  std::vector<Instruction> text;
+  LiteralStats literals;
+  // label name -> address in text
+  Labels labels;
+};
+
+constexpr bool isSpace(char c) noexcept {
+  return c == ' ' || c == '\t' || c == '\r' || c == '\n' || c == '\v' ||
+         c == '\f';
+}
+
+constexpr std::string_view trim(std::string_view s) noexcept {
+  while (!s.empty() && isSpace(s.front()))
+    s.remove_prefix(1);
+  while (!s.empty() && isSpace(s.back()))
+    s.remove_suffix(1);
+  return s;
+}
+
+// splits the next whitespace separated token off of s
+constexpr std::string_view token(std::string_view &s) noexcept {
+  s = trim(s);
+  auto end = std::find_if(s.begin(), s.end(), isSpace) - s.begin();
+  auto t = s.substr(0, end);
+  s.remove_prefix(end);
+  return t;
+}
+
+// splits the next line off of s
+constexpr std::string_view line(std::string_view &s) noexcept {
+  auto end = s.find('\n');
+  auto l = s.substr(0, end);
+  s.remove_prefix(end == s.npos ? s.size() : end + 1);
+  return l;
+}
+
+// integers the way strtol reads them with base 0
+constexpr std::optional<size_t> number(std::string_view s) noexcept {
+  bool negative = false;
+  if (!s.empty() && (s.front() == '-' || s.front() == '+')) {
+    negative = s.front() == '-';
+    s.remove_prefix(1);
+  }
+  size_t base = 10;
+  if (s.size() > 1 && s[0] == '0' && (s[1] == 'x' || s[1] == 'X')) {
+    base = 16;
+    s.remove_prefix(2);
+  } else if (s.size() > 1 && s[0] == '0') {
+    base = 8;
+  }
+  if (s.empty())
+    return {};
+  size_t result = 0;
+  for (char c : s) {
+    size_t digit = base;
+    if (c >= '0' && c <= '9')
+      digit = c - '0';
+    else if (c >= 'a' && c <= 'f')
+      digit = c - 'a' + 10;
+    else if (c >= 'A' && c <= 'F')
+      digit = c - 'A' + 10;
+    if (digit >= base)
+      return {};
+    result = result * base + digit;
+  }
+  return negative ? size_t(0) - result : result;
+}
+
+constexpr void parseData(std::string_view d, Source &src) {
+  while (!d.empty()) {
+    auto l = line(d);
+    auto type = token(l);
+    if (type.empty())
+      continue;
+    auto identifier = std::string(token(l));
+    if (type == ".ascii") {
+      auto begin = l.find('\''), end = l.rfind('\'');
+      if (begin == l.npos || begin == end)
+        throw std::runtime_error(".ascii needs a quoted string");
+      auto start = src.data.size();
+      auto text = l.substr(begin + 1, end - begin - 1);
+      for (size_t i = 0; i != text.size(); ++i) {
+        uint32_t c = text[i];
+        if (c == '\\' && i + 1 != text.size() && text[i + 1] == 'n') {
+          c = '\n';
+          ++i;
+        }
+        src.data.push_back(Word{Val{c}});
+      }
+      src.globals.insert({identifier, start});
+    } else if (type == ".int") {
+      auto i = number(token(l));
+      if (!i)
+        throw std::runtime_error(".int needs an integer");
+      src.data.push_back(Word{Val{static_cast<uint32_t>(*i)}});
+      src.globals.insert({identifier, *i});
+    } else {
+      throw std::runtime_error("unknown data directive");
+    }
+  }
+}
+
+constexpr void parseText(std::string_view a, Source &src) {
+  while (!a.empty()) {
+    auto l = line(a);
+    auto instruction = token(l);
+    if (instruction.empty())
+      continue;
+    if (instruction.starts_with("@")) {
+      auto name = trim(l);
+      src.labels.insert(
+          {std::string(name.empty() ? instruction : name), src.code.size()});
+      continue;
+    }
+    auto type = instruction_table.find(instruction);
+    if (type == instruction_table.end())
+      throw std::runtime_error("unknown instruction");
+    UnfinishedInstruction unfinished{.instruct = type->second};
+    auto operand_count = static_cast<int>(operandCount(unfinished.instruct));
+    if (operand_count >= 1)
+      unfinished.a = token(l);
+    if (operand_count >= 2)
+      unfinished.b = token(l);
+    if (operand_count == 3)
+      unfinished.out = token(l);
+    src.code.push_back(std::move(unfinished));
+  }
+  src.code.push_back(UnfinishedInstruction{.instruct = InstructionType::hlt});
+}
+
+constexpr Source parse(std::string_view data, std::string_view text) {
+  Source src;
+  parseData(data, src);
+  parseText(text, src);
+  return src;
+}
+
+using Value = std::variant<Register, size_t>;
+
+template <typename R> constexpr R operand(const Value &v) {
+  if (auto r = std::get_if<Register>(&v)) {
+    auto reg = RegisterOperand{.operand = *r};
+    if constexpr (std::is_same_v<R, Operand>)
+      return Operand{.reg = reg};
+    else
+      return R(reg);
+  }
+  auto lit = static_cast<uint32_t>(std::get<size_t>(v));
+  if constexpr (std::is_same_v<R, Operand>)
+    return Operand{.lit = Literal(lit)};
+  else if constexpr (std::is_same_v<R, SemiwideOperand>)
+    return SemiwideOperand(SemiLiteral(lit));
+  else
+    return WideOperand(WideLiteral(lit));
+}
+
+// the literal type each operand position gets encoded as
+enum struct Slot : uchar { none, narrow, semi, wide };
+
+constexpr std::array<Slot, 2> slots(InstructionType i) {
+  switch (operandCount(i)) {
+  case opCount::zero:
+    return {Slot::none, Slot::none};
+  case opCount::one:
+    return {Slot::wide, Slot::none};
+  case opCount::two:
+    return {Slot::narrow, Slot::semi};
+  case opCount::three:
+    return {Slot::narrow, Slot::narrow};
+  }
+  throw std::logic_error("invalid instruction operand count");
+}
+
+constexpr bool fits(Slot s, uint32_t val) {
+  switch (s) {
+  case Slot::none:
+    return false;
+  case Slot::narrow:
+    return Literal::fits(val);
+  case Slot::semi:
+    return SemiLiteral::fits(val);
+  case Slot::wide:
+    return WideLiteral::fits(val);
+  }
+  return false;
+}
+
+constexpr bool isRotated(Slot s, uint32_t val) {
+  switch (s) {
+  case Slot::narrow:
+    return Literal(val).rotate != 0;
+  case Slot::wide:
+    return WideLiteral(val).rotate != 0;
+  default:
+    return false;
+  }
+}
+
+struct ResolvedInstruction {
+  InstructionType instruct;
+  std::array<Value, 2> vals{};
+  Register out = Register::invalid;
+  // operand that does not fit its slot and is loaded from the literal pool
+  int pooled = -1;
+  Register scratch = Register::invalid;
+  // a pooled mov is just an ldc, everything else needs one in front of it
+  constexpr bool grows() const noexcept {
+    return pooled >= 0 && instruct != InstructionType::mov;
+  }
+};
+
+constexpr ResolvedInstruction resolve(const UnfinishedInstruction &s,
+                                      const Source &src) {
+  auto process = [&](const std::string &s) -> Value {
+    auto reg = register_table.find(s);
+    if (reg != register_table.end()) {
+      return reg->second;
+    }
+    auto global = src.globals.find(s);
+    if (global != src.globals.end()) {
+      return global->second & literal_mask;
+    }
+    auto label = src.labels.find(s);
+    if (label != src.labels.end()) {
+      return label->second;
+    }
+    if (auto i = number(s)) {
+      return *i & literal_mask;
+    }
+    throw std::runtime_error("operand is not a register, name or number");
+  };
+
+  ResolvedInstruction r{.instruct = s.instruct};
+  auto kinds = slots(s.instruct);
+  for (auto [n, text] : {std::pair{0, &s.a}, std::pair{1, &s.b}}) {
+    if (kinds[n] == Slot::none)
+      continue;
+    if (text->empty())
+      throw std::runtime_error("instruction is missing an operand");
+    r.vals[n] = process(*text);
+  }
+  if (operandCount(s.instruct) == opCount::three) {
+    auto reg = register_table.find(s.out);
+    if (reg == register_table.end())
+      throw std::runtime_error("destination is not a register");
+    r.out = reg->second;
+  }
+
+  for (int n = 0; n != 2; ++n) {
+    auto lit = std::get_if<size_t>(&r.vals[n]);
+    if (kinds[n] == Slot::none || lit == nullptr || fits(kinds[n], *lit))
+      continue;
+    if (r.pooled >= 0)
+      throw std::runtime_error("only one literal per instruction can be "
+                               "loaded from the literal pool");
+    r.pooled = n;
+  }
+  // a pooled literal can only be loaded into a register
+  auto destination = [&] {
+    if (auto reg = std::get_if<Register>(&r.vals[1]))
+      return *reg;
+    throw std::runtime_error("destination is not a register");
+  };
+  if (!r.grows()) {
+    if (r.pooled >= 0)
+      destination();
+    return r;
+  }
+
+  // the pooled literal is loaded into the destination register, which only
+  // works if it isn't read by the instruction as well
+  switch (s.instruct) {
+  case InstructionType::addi:
+  case InstructionType::subi:
+  case InstructionType::muli:
+  case InstructionType::divi: {
+    auto other = std::get_if<Register>(&r.vals[1 - r.pooled]);
+    if (other == nullptr || *other != r.out)
+      r.scratch = r.out;
+    break;
+  }
+  case InstructionType::alloc:
+  case InstructionType::load:
+  case InstructionType::recv:
+    if (r.pooled == 0)
+      r.scratch = destination();
+    break;
+  default:
+    break;
+  }
+  if (r.scratch == Register::invalid || r.scratch == Register::ip)
+    throw std::runtime_error(
+        "literal cannot be encoded and there is no register to load it into");
+  return r;
+}
+
+constexpr uint32_t poolAddress(std::vector<Word> &data,
+                               Table<uint32_t, size_t> &pool, uint32_t val) {
+  auto [entry, inserted] = pool.insert({val, data.size()});
+  if (inserted)
+    data.push_back(Word{Val{val}});
+  if (!SemiLiteral::fits(entry->second))
+    throw std::runtime_error("literal pool is out of addressable range");
+  return entry->second;
+}
+
+constexpr void finishInstruction(const ResolvedInstruction &r,
+                                 std::vector<Word> &data,
+                                 Table<uint32_t, size_t> &pool,
+                                 LiteralStats &stats,
+                                 std::vector<Instruction> &out) {
+  auto vals = r.vals;
+  auto kinds = slots(r.instruct);
+  for (int n = 0; n != 2; ++n) {
+    auto lit = std::get_if<size_t>(&vals[n]);
+    if (kinds[n] == Slot::none || lit == nullptr || n == r.pooled)
+      continue;
+    if (isRotated(kinds[n], *lit))
+      ++stats.rotated;
+    else
+      ++stats.direct;
+  }
+
+  if (r.pooled >= 0) {
+    ++stats.pooled;
+    auto address =
+        poolAddress(data, pool, std::get<size_t>(vals[r.pooled]));
+    auto into = r.grows() ? r.scratch : std::get<Register>(vals[1]);
+    out.push_back(Instruction(
+        InstructionType::ldc, BiOps{.a = operand<Operand>(into),
+                                    .b = operand<SemiwideOperand>(address)}));
+    if (!r.grows())
+      return;
+    vals[r.pooled] = r.scratch;
+  }
+
+  switch (operandCount(r.instruct)) {
+  case opCount::zero:
+    out.push_back(Instruction(r.instruct));
+    return;
+  case opCount::one:
+    out.push_back(Instruction(r.instruct, operand<WideOperand>(vals[0])));
+    return;
+  case opCount::two:
+    out.push_back(Instruction(r.instruct,
+                              BiOps{.a = operand<Operand>(vals[0]),
+                                    .b = operand<SemiwideOperand>(vals[1])}));
+    return;
+  case opCount::three:
+    out.push_back(Instruction(r.instruct,
+                              TriOps{.a = operand<Operand>(vals[0]),
+                                     .b = operand<Operand>(vals[1]),
+                                     .out = r.out}));
+    return;
+  }
+  throw std::logic_error("invalid instruction operand count");
+}
+
+constexpr Assembled encode(Source src) {
+  // an ldc in front of an instruction moves every label after it, which can
+  // push other label operands out of range. Instructions that grew stay grown
+  // so this always settles.
+  auto positions = src.labels;
+  std::vector<bool> grown(src.code.size());
+  std::vector<ResolvedInstruction> resolved(src.code.size());
+  for (bool changed = true; changed;) {
+    changed = false;
+    std::vector<size_t> address(src.code.size());
+    for (size_t i = 0, at = 0; i != src.code.size(); ++i) {
+      address[i] = at;
+      at += grown[i] ? 2 : 1;
+    }
+    for (auto &[label, pos] : positions) {
+      src.labels[label] = address[pos];
+    }
+    for (size_t i = 0; i != src.code.size(); ++i) {
+      resolved[i] = resolve(src.code[i], src);
+      if (resolved[i].grows() && !grown[i]) {
+        grown[i] = true;
+        changed = true;
+      }
+    }
+  }
+
+  Assembled result{.data = std::move(src.data), .labels = src.labels};
+  Table<uint32_t, size_t> pool;
+  result.text.reserve(src.code.size());
+  for (size_t i = 0; i != resolved.size(); ++i) {
+    if (grown[i] && !resolved[i].grows())
+      result.text.push_back(Instruction(InstructionType::noop));
+    finishInstruction(resolved[i], result.data, pool, result.literals,
+                      result.text);
+  }
+  return result;
+}
+
+} // namespace tri::inline TRI_LAYOUT::detail
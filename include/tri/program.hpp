@@ -0,0 +1,73 @@
+#pragma once
+
+#include "tri/asm.hpp"
+#include "tri/detail/assembler.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <string_view>
+#include <utility>
+
+namespace tri::inline TRI_LAYOUT {
+// a string literal usable as a template argument
+template <size_t N> struct FixedString {
+  char chars[N];
+  constexpr FixedString(const char (&s)[N]) { std::copy_n(s, N, chars); }
+  constexpr std::string_view view() const noexcept { return {chars, N - 1}; }
+};
+
+// an Executable that was assembled at compile time
+template <size_t T, size_t D, size_t L> struct Image {
+  std::array<Instruction, T> text;
+  std::array<Word, D> data;
+  LiteralStats literals;
+  // names point into the program's source text
+  std::array<std::pair<std::string_view, uint32_t>, L> labels;
+
+  Executable executable() const {
+    Executable e{
+        {data.begin(), data.end()}, {text.begin(), text.end()}, literals};
+    for (auto &[name, address] : labels)
+      e.labels.insert({std::string(name), address});
+    return e;
+  }
+};
+
+namespace detail {
+template <typename T, size_t N, size_t... I>
+constexpr std::array<T, N> toArray(const std::vector<T> &v,
+                                   std::index_sequence<I...>) {
+  return {v[I]...};
+}
+
+template <FixedString Text, FixedString Data> consteval auto image() {
+  constexpr auto sizes = [] {
+    auto a = encode(parse(Data.view(), Text.view()));
+    return std::array{a.text.size(), a.data.size(), a.labels.entries.size()};
+  }();
+  auto a = encode(parse(Data.view(), Text.view()));
+  Image<sizes[0], sizes[1], sizes[2]> result{
+      toArray<Instruction, sizes[0]>(a.text,
+                                     std::make_index_sequence<sizes[0]>()),
+      toArray<Word, sizes[1]>(a.data, std::make_index_sequence<sizes[1]>()),
+      a.literals};
+  // a label's name is always somewhere in the source, so the image can refer
+  // to that instead of owning a copy
+  for (size_t i = 0; i != sizes[2]; ++i) {
+    auto &[name, address] = a.labels.entries[i];
+    auto view = Text.view();
+    result.labels[i] = {view.substr(view.find(name), name.size()),
+                        static_cast<uint32_t>(address)};
+  }
+  return result;
+}
+} // namespace detail
+
+// Assembles at compile time, assembly errors become compile errors and the
+// image ends up in read only data instead of being built at startup.
+//   constexpr auto &hello = tri::program<"mov 0x48 r0\nout r0">;
+//   auto run = tri::Interpreter(hello.executable());
+template <FixedString Text, FixedString Data = "">
+constexpr auto program = detail::image<Text, Data>();
+} // namespace tri::inline TRI_LAYOUT
@@ -0,0 +1,13 @@
+#pragma once
+
+#include "tri/asm.hpp"
+#include "tri/detail/assembler.hpp"
+
+// the optimizer only runs at runtime, so it stays out of the public headers
+namespace tri::inline TRI_LAYOUT::detail {
+// Rewrites code in place and moves labels along with it. Programs that do
+// arithmetic on ip, rp or label addresses, or jump to numeric addresses, are
+// left alone since removing instructions would change what they compute.
+void optimize(Code &code, Labels &labels, const Globals &globals,
+              OptimizeStats &stats);
+} // namespace tri::inline TRI_LAYOUT::detail
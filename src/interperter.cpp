@@ -5,16 +5,22 @@
 #include "tri/asm.hpp"
 #undef TRI_ENABLE_FMT_FORMATTING
 
+#include "lanes.hpp"
+
+#include <algorithm>
 #include <bit>
 #include <bitset>
 #include <chrono>
 #include <cstdint>
+#include <cstring>
 #include <exception>
 #include <iostream>
+#include <new>
 #include <span>
 #include <stdexcept>
 #include <string_view>
 #include <thread>
+#include <type_traits>
 
 using namespace tri;
 namespace {
@@ -22,197 +28,904 @@ std::string log(Instruction i) {
   return std::string(tri::instruction_names.at(i.instruct));
 }
 uint64_t change_bit(uint64_t val, unsigned num) { return (val & ~(1 << num)); }
+
+// The bulk memory kernels work on the raw bytes so libc's vectorised
+// routines do the work. A word's tag is one of its bits, so it is copied
+// along with the rest.
+void copyWords(std::span<Word> to, std::span<const Word> from) {
+  std::memmove(static_cast<void *>(to.data()), from.data(),
+               from.size_bytes());
+}
+
+void fillWords(std::span<Word> to, Word w) {
+  if (to.empty())
+    return;
+  to[0] = w;
+  // doubles what has been filled so far until it covers everything
+  for (size_t done = 1; done != to.size();) {
+    auto n = std::min(done, to.size() - done);
+    std::memcpy(static_cast<void *>(to.data() + done), to.data(),
+                n * sizeof(Word));
+    done += n;
+  }
+}
+
+// 0 if equal, otherwise one past the index of the first differing word
+uint32_t firstDifference(std::span<const Word> l, std::span<const Word> r) {
+  constexpr size_t block = 16;
+  size_t i = 0;
+  // whole blocks are compared with memcmp, only a differing one is looked at
+  // word by word
+  while (i + block <= l.size() &&
+         std::memcmp(l.data() + i, r.data() + i, block * sizeof(Word)) == 0)
+    i += block;
+  for (; i != l.size(); ++i) {
+    if (std::memcmp(&l[i], &r[i], sizeof(Word)) != 0)
+      return i + 1;
+  }
+  return 0;
+}
 } // namespace
-tri::Interpreter::Interpreter(Executable &&e)
-    : text(std::move(e.text)), stack(std::move(e.data)) {
-  if (!stack.empty())
-    sp() = stack.size() - 1;
+tri::Program::Program(Executable &&e) {
+  auto built = std::make_shared<Image>();
+  built->text = std::move(e.text);
+  built->labels = std::move(e.labels);
+  built->dataWords = e.data.size();
+  for (size_t at = 0; at < e.data.size(); at += page_words) {
+    auto end = e.data.begin() + std::min(at + page_words, e.data.size());
+    built->pages.push_back(
+        std::make_shared<std::vector<Word>>(e.data.begin() + at, end));
+  }
+  built->verified = verify(built->text);
+  built->optimized = e.optimized.before != 0;
+  image = std::move(built);
+}
+
+tri::Interpreter::Interpreter(const Program &program) {
+  load(program);
+  if (dataWords != 0)
+    sp() = dataWords - 1;
   bp() = sp();
 }
 
-void tri::Interpreter::execute() {
+tri::Interpreter::Interpreter(Executable &&e)
+    : Interpreter(Program(std::move(e))) {}
+
+void tri::Interpreter::load(const Program &from) {
+  program = from;
+  text = &program.image->text;
+  data = program.image->pages;
+  dataWords = program.image->dataWords;
+  checked = !program.verified();
+}
+
+tri::Status tri::Interpreter::execute() {
+  if (heat.size() != text->size()) {
+    sites.resize(text->size());
+    heat.resize(text->size());
+  }
+  trapped = {};
+  interrupted = traceEvent = blocked = false;
+  recording.clear();
+  // resuming after the last hlt would run off the end of text
+  if (ip().val >= text->size()) {
+    raise(TrapCode::ip_range, ip());
+    interrupted = false;
+    if (!deliver(ip().val))
+      return Status::trapped;
+  }
+  if (checked)
+    return run<true>();
+  else
+    return run<false>();
+}
+
+bool tri::Interpreter::trap_handler(std::string_view label) {
+  if (program.image->optimized)
+    return false;
+  auto &labels = program.labels();
+  auto l = labels.find(std::string(label));
+  if (l == labels.end() || l->second >= text->size())
+    return false;
+  handler = l->second;
+  return true;
+}
+
+// Hands the pending trap to the guest handler if there is one, otherwise
+// leaves ip on the faulting instruction for the host.
+bool tri::Interpreter::deliver(Val::Data at) noexcept {
+  trapped.ip = at;
+  if (!handler || handling) {
+    ip().val = at;
+    return false;
+  }
+  handling = sp().val;
+  rp() = Val(at);
+  reg(Register::r0) = Val(static_cast<uint32_t>(trapped.code));
+  ip() = Val(*handler);
+  trapped = {};
+  return true;
+}
+
+template <bool Checked> tri::Status tri::Interpreter::run() {
+  auto &code = *text;
+  // the instruction being run
+  Val::Data at = 0;
   // these are organized here bc I try to minimize stuff in headers
   // and it has to be in function bc of visibility rules
   // this is not ideal
-  auto handleUnary = [this](tri::Instruction i) {
+  auto eval = [this](auto o) -> Word {
+    if (o.lit.type == tri::Type::lit) {
+      return Val(o.lit);
+    } else {
+      return reg<Checked>(o.reg.operand);
+    }
+  };
+  // a trapping instruction leaves its destination alone so it can be retried
+  auto result = [this](auto o, Word w) {
+    auto &to = reg<Checked>(o);
+    if (!faulted())
+      to = w;
+  };
+  // verified text only has in range literal targets, registers still need
+  // checking
+  auto jump = [this, &code, &at](auto o, Word target) {
+    if ((Checked || o.lit.type == tri::Type::reg) &&
+        (target.val.is_alloc || target.val >= code.size())) [[unlikely]] {
+      raise(TrapCode::jump_range, target);
+      return;
+    }
+    ip().val = target.val;
+    // backward jumps are loops, their heads get traced once they're hot
+    if (tracing && target.val <= at &&
+        ++heat[target.val] >= trace_threshold) [[unlikely]] {
+      heat[target.val] = trace_threshold;
+      traceEvent = interrupted = true;
+    }
+  };
+
+  // the stack grows up and sp points at the top word
+  auto push = [this](Word w) {
+    sp() = sp() + Word(Val(1));
+    deref<true>(sp()) = w;
+  };
+  auto pop = [this]() -> Word {
+    auto w = deref<false>(sp());
+    sp() = sp() - Word(Val(1));
+    return w;
+  };
+
+  auto handleNullary = [&, this](tri::Instruction i) {
+    switch (i.instruct) {
+    case InstructionType::leave:
+      sp() = bp();
+      bp() = pop();
+      rp() = pop();
+      return;
+    case InstructionType::ret:
+      // rp is a register target, so it is checked even in verified text
+      if (rp().val.is_alloc || rp().val >= code.size()) [[unlikely]]
+        raise(TrapCode::jump_range, rp());
+      else
+        ip().val = rp().val;
+      returned();
+      return;
+    default:
+      return;
+    }
+  };
+
+  auto handleUnary = [&, this](tri::Instruction i) {
     auto wide = i.op.unary;
-    auto eval = [&](auto o) -> Word {
-      if (o.lit.type == tri::Type::lit) {
-        return Val(o.lit);
-      } else {
-        return reg(o.reg);
-      }
-    };
     switch (i.instruct) {
     case InstructionType::out: {
-      out(reg(wide.reg).val);
+      uint32_t word = reg<Checked>(wide).val;
+      if (ports[0].out.push(word))
+        logIo(0, true, word);
+      else
+        block(0, true);
       return;
     }
     case InstructionType::in: {
-      reg(wide.reg).val.is_alloc = false;
-      reg(wide.reg).val = in();
+      // a bad destination traps before the word is taken, for the retry
+      auto &into = reg<Checked>(wide);
+      uint32_t word;
+      if (faulted())
+        return;
+      if (ports[0].in.pop(word)) {
+        into = Val(word);
+        logIo(0, false, word);
+      } else {
+        block(0, false);
+      }
       return;
     }
     case InstructionType::call:
       rp().val = ip().val;
       [[fallthrough]];
     case InstructionType::jmp: {
-      ip().val = eval(wide);
+      jump(wide, eval(wide));
+      if (i.instruct == InstructionType::jmp && wide.reg.type == Type::reg &&
+          wide.reg.operand == Register::rp)
+        returned();
+      return;
+    }
+    case InstructionType::push:
+      push(eval(wide));
+      return;
+    case InstructionType::pop: {
+      // a bad operand traps before anything is popped
+      auto &into = reg<Checked>(wide);
+      if (!faulted())
+        into = pop();
+      return;
+    }
+    case InstructionType::enter: {
+      auto locals = eval(wide);
+      if (locals.val.is_alloc) [[unlikely]] {
+        raise(TrapCode::alloc_arithmetic, locals);
+        return;
+      }
+      push(rp());
+      push(bp());
+      bp() = sp();
+      // the stack grows once for all of them, and they're zeroed since
+      // stale pointers left by earlier frames would otherwise keep objects
+      // alive through clean()
+      auto frame = range<true>(sp() + Word(Val(1)), locals.val);
+      if (faulted())
+        return;
+      fillWords(frame, Val(0));
+      sp() = sp() + locals;
       return;
     }
     default: {
-      throw std::logic_error("non-unary operator incorrectly handled");
+      raise(TrapCode::invalid_instruction);
     }
     }
   };
 
-  auto handleBinary = [this](tri::Instruction i) {
-    auto eval = [&](auto o) -> Word {
-      if (o.lit.type == tri::Type::lit) {
-        return Val(o.lit);
-      } else {
-        return reg(o.reg);
-      }
+  // lanes are only ever Vals, vld and vset trap on pointers so a vector
+  // never has to be scanned by clean(). lanes stay 31 bits with wide words,
+  // which keep only their low bits on the way in
+  auto &kernels = detail::laneKernels();
+  auto lane = [](Val v) { return uint32_t(v.data) & ((1u << 31) - 1); };
+  auto handleLanes = [&, this](tri::Instruction i) {
+    auto op = [&](detail::LaneOp kernel) {
+      auto &t = i.op.ternary;
+      kernel(vec<Checked>(t.out), vec<Checked>(t.a), vec<Checked>(t.b));
+    };
+    auto reduce = [&](detail::LaneReduction kernel) {
+      auto &v = vec<Checked>(i.op.binary.a);
+      reg<Checked>(i.op.binary.b) = Val(kernel(v));
     };
+    switch (i.instruct) {
+    case InstructionType::vadd:
+      return op(kernels.add);
+    case InstructionType::vsub:
+      return op(kernels.sub);
+    case InstructionType::vmul:
+      return op(kernels.mul);
+    case InstructionType::vmin:
+      return op(kernels.min);
+    case InstructionType::vmax:
+      return op(kernels.max);
+    case InstructionType::vcmp:
+      return op(kernels.cmp);
+    case InstructionType::vsum:
+      return reduce(kernels.sum);
+    case InstructionType::vhmin:
+      return reduce(kernels.hmin);
+    case InstructionType::vhmax:
+      return reduce(kernels.hmax);
+    case InstructionType::vld: {
+      auto &v = vec<Checked>(i.op.binary.b);
+      auto words = range<false>(eval(i.op.binary.a), lane_count);
+      if (faulted())
+        return;
+      Lanes loaded;
+      for (size_t n = 0; n != lane_count; ++n) {
+        if (words[n].val.is_alloc) [[unlikely]] {
+          raise(TrapCode::alloc_arithmetic, words[n]);
+          return;
+        }
+        loaded[n] = lane(words[n].val);
+      }
+      v = loaded;
+      return;
+    }
+    case InstructionType::vst: {
+      auto &v = vec<Checked>(i.op.binary.a);
+      auto words = range<true>(eval(i.op.binary.b), lane_count);
+      if (faulted())
+        return;
+      for (size_t n = 0; n != lane_count; ++n)
+        words[n] = Val(v[n]);
+      return;
+    }
+    case InstructionType::vset: {
+      auto w = eval(i.op.binary.a);
+      auto &v = vec<Checked>(i.op.binary.b);
+      if (w.val.is_alloc) [[unlikely]] {
+        raise(TrapCode::alloc_arithmetic, w);
+        return;
+      }
+      v.fill(lane(w.val));
+      return;
+    }
+    default:
+      raise(TrapCode::invalid_instruction);
+    }
+  };
+
+  auto handleBinary = [&, this](tri::Instruction i) {
+    if (isVectorInstruction(i.instruct)) [[unlikely]]
+      return handleLanes(i);
     auto a = eval(i.op.binary.a), b = eval(i.op.binary.b);
     switch (i.instruct) {
     case InstructionType::jnz:
       if (a != tri::nullw) {
-        ip().val = b;
+        jump(i.op.binary.b, b);
       }
       return;
     case InstructionType::jez:
       if (a == tri::nullw) {
-        ip().val = b;
+        jump(i.op.binary.b, b);
       }
       return;
     case InstructionType::alloc:
-      reg(i.op.binary.b.reg).alloc = alloc(a.val);
+      result(i.op.binary.b, alloc(a.val));
       return;
     case InstructionType::mov:
-      reg(i.op.binary.b.reg) = a;
+      reg<Checked>(i.op.binary.b) = a;
       return;
     case InstructionType::load:
-      reg(i.op.binary.b.reg) = deref(a);
+      result(i.op.binary.b, deref<false>(a, sites[at]));
       return;
     case InstructionType::store:
-      deref(reg(i.op.binary.b.reg)) = a;
+      deref<true>(reg<Checked>(i.op.binary.b), sites[at]) = a;
+      return;
+    case InstructionType::ldc:
+      result(i.op.binary.a, deref<false>(b));
+      return;
+    case InstructionType::recv:
+      if (auto port = guestPort(a)) {
+        auto &into = reg<Checked>(i.op.binary.b);
+        uint32_t word;
+        if (faulted())
+          return;
+        if (port->in.pop(word)) {
+          into = Val(word);
+          logIo(a.val, false, word);
+        } else {
+          block(a.val, false);
+        }
+      }
+      return;
+    case InstructionType::send:
+      if (auto port = guestPort(b)) {
+        uint32_t word = a.val;
+        if (port->out.push(word))
+          logIo(b.val, true, word);
+        else
+          block(b.val, true);
+      }
       return;
     default:
-      throw std::logic_error("non-tertiary operator incorrectly handled");
+      raise(TrapCode::invalid_instruction);
     }
   };
 
-  auto handleTertiary = [this](tri::Instruction i) {
-    auto eval = [&](tri::Operand o) -> Word {
-      if (o.lit.type == tri::Type::lit) {
+  // mcpy src dst len, mset dst val len and mcmp l r len, which leaves the
+  // result in len
+  auto bulk = [this](InstructionType type, Word a, Word b, Word &len) {
+    if (len.val.is_alloc) [[unlikely]] {
+      raise(TrapCode::alloc_arithmetic, len);
+      return;
+    }
+    Val::Data n = len.val.data;
+    switch (type) {
+    case InstructionType::mcpy: {
+      auto to = range<true>(b, n);
+      auto from = range<false>(a, n);
+      // growing or flattening the stack for from can move to
+      if (!a.val.is_alloc && !b.val.is_alloc)
+        to = range<true>(b, n);
+      if (!faulted())
+        copyWords(to, from);
+      return;
+    }
+    case InstructionType::mset: {
+      auto to = range<true>(a, n);
+      if (!faulted())
+        fillWords(to, b);
+      return;
+    }
+    case InstructionType::mcmp: {
+      auto l = range<false>(a, n);
+      auto r = range<false>(b, n);
+      if (!a.val.is_alloc && !b.val.is_alloc)
+        l = range<false>(a, n);
+      if (!faulted())
+        len = Val(firstDifference(l, r));
+      return;
+    }
+    default:
+      raise(TrapCode::invalid_instruction);
+    }
+  };
+
+  // addi and subi get a handler per tag combination, picked by testing the
+  // tags as one number. Which operands are literals is decoded from the
+  // instruction first and each form is its own instantiation: a literal
+  // always decodes to a Val, so only registers have their tag tested. The
+  // results are the same as the Word operators'.
+  auto arithmetic = [&, this](tri::Instruction i, auto aLit, auto bLit) {
+    auto &t = i.op.ternary;
+    auto operand = [this](Operand o, auto lit) -> Word {
+      if constexpr (decltype(lit)::value)
         return Val(o.lit);
-      } else {
-        return reg(o.reg);
-      }
+      else
+        return reg<Checked>(o.reg.operand);
     };
-    auto a = eval(i.op.ternary.a), b = eval(i.op.ternary.b);
-    auto out = [&]() -> Word & { return reg(i.op.ternary.out); };
-    switch (i.instruct) {
-    case InstructionType::addi: {
-      auto n = a + b;
-      out() = n;
+    auto a = operand(t.a, aLit), b = operand(t.b, bLit);
+    auto out = [&]() -> Word & { return reg<Checked>(t.out); };
+    auto add = i.instruct == InstructionType::addi;
+    auto aAlloc = !aLit && a.val.is_alloc, bAlloc = !bLit && b.val.is_alloc;
+    switch (unsigned(aAlloc) << 1 | unsigned(bAlloc)) {
+    case 0b00: {
+      Val::Data x = a.val.data, y = b.val.data;
+      out().val = Val(add ? x + y : x - y);
       return;
     }
-    case InstructionType::subi:
-      out() = a - b;
+    case 0b10: {
+      Val::Data x = a.alloc.offset, y = b.val.data;
+      out().alloc = Alloc(a.alloc.number, Alloc::Offset(add ? x + y : x - y));
       return;
+    }
+    case 0b01: {
+      // subi takes the Val from the offset here too
+      Val::Data x = b.alloc.offset, y = a.val.data;
+      out().alloc = Alloc(b.alloc.number, Alloc::Offset(add ? x + y : x - y));
+      return;
+    }
+    default:
+      if (add) [[unlikely]] {
+        raise(TrapCode::alloc_arithmetic, a, b);
+        return;
+      }
+      // the distance between two pointers
+      out().val = Val(Val::Data(a.alloc.offset) - b.alloc.offset);
+    }
+  };
+  auto handleArithmetic = [&](tri::Instruction i) {
+    auto &t = i.op.ternary;
+    using lit = std::true_type;
+    using reg = std::false_type;
+    switch (unsigned(t.a.lit.type == tri::Type::lit) << 1 |
+            unsigned(t.b.lit.type == tri::Type::lit)) {
+    case 0b00:
+      return arithmetic(i, reg{}, reg{});
+    case 0b01:
+      return arithmetic(i, reg{}, lit{});
+    case 0b10:
+      return arithmetic(i, lit{}, reg{});
+    default:
+      return arithmetic(i, lit{}, lit{});
+    }
+  };
+
+  auto handleTertiary = [&, this](tri::Instruction i) {
+    if (i.instruct == InstructionType::addi ||
+        i.instruct == InstructionType::subi) [[likely]]
+      return handleArithmetic(i);
+    if (isVectorInstruction(i.instruct)) [[unlikely]]
+      return handleLanes(i);
+    auto a = eval(i.op.ternary.a), b = eval(i.op.ternary.b);
+    auto out = [&]() -> Word & { return reg<Checked>(i.op.ternary.out); };
+    // the Word operators throw on these, so they're caught beforehand
+    auto either = a.val.is_alloc || b.val.is_alloc;
+    switch (i.instruct) {
     case InstructionType::muli:
+      if (either) [[unlikely]] {
+        raise(TrapCode::alloc_arithmetic, a, b);
+        return;
+      }
       out() = a * b;
       return;
     case InstructionType::divi:
+      if (either) [[unlikely]] {
+        raise(TrapCode::alloc_arithmetic, a, b);
+        return;
+      }
       out() = a / b;
       return;
+    case InstructionType::realloc:
+      result(i.op.ternary.out, resize(a, b));
+      return;
     default:
-      throw std::logic_error("non-tertiary operator incorrectly handled");
+      bulk(i.instruct, a, b, out());
     }
   };
 
-  auto operand = [this](Operand o) -> tri::Word {
-    auto type = o.lit.type;
-    switch (type) {
-    case Type::reg:
-      return reg(o.reg.operand);
-    case Type::lit:
-      return tri::Word(std::rotl(o.lit.value, o.lit.rotate));
-    }
-  };
-  while (true) {
-    auto instruction = text[ip().val];
-    ip().val = ip().val + 1;
-    switch (tri::operandCount(instruction.instruct)) {
+  auto dispatch = [&](tri::Instruction i) {
+    switch (tri::operandCount(i.instruct)) {
     case opCount::zero:
-      if (instruction.instruct == tri::InstructionType::hlt)
-        return;
+      handleNullary(i);
       break;
     case opCount::one:
-      handleUnary(instruction);
+      handleUnary(i);
       break;
     case opCount::two:
-      handleBinary(instruction);
+      handleBinary(i);
       break;
     case opCount::three:
-      handleTertiary(instruction);
+      handleTertiary(i);
       break;
-    default:
-      throw std::logic_error("this really shouldn't happen");
     }
-    if (debug) {
-      fmt::print("{}: i: {} s: {} b: {} r: {} [{}]\n", log(instruction),
-                 int(ip().val), int(sp().val), int(bp().val), int(rp().val),
-                 fmt::join(std::span(registers).subspan(4), "|"));
-      using namespace std::chrono_literals;
-      std::this_thread::sleep_for(100ms);
+  };
+
+  // Runs a trace until a guard fails, leaving ip where the interpreter
+  // should carry on. A trap or suspension leaves at on the step that caused
+  // it instead. The specialised steps use unchecked registers, they ran
+  // without trapping while being recorded and only their tags can change.
+  auto runTrace = [&, this](Trace &trace) {
+    std::chrono::steady_clock::time_point started;
+    if (timeTraces) [[unlikely]]
+      started = std::chrono::steady_clock::now();
+    ++traceStats.entered;
+    auto value = [this](auto o) -> Word {
+      if (o.lit.type == tri::Type::lit)
+        return Val(o.lit);
+      return reg<false>(o.reg.operand);
+    };
+    size_t s = 0, ran = 0;
+    bool guardFailed = false;
+    // retired is only brought up to date where a step could log I/O or
+    // leave the trace, counting steps here keeps it out of the loop
+    auto base = retired;
+    // the last step jumps back to the head, and a while loop tests at the
+    // head, so a guard failing on either is the loop ending
+    auto left = [&] {
+      if (s == 0 || s + 1 == trace.size())
+        ++traceStats.loop_exits;
+      else
+        ++traceStats.side_exits;
+      guardFailed = true;
+    };
+    // false once a guard failed
+    auto step = [&]() -> bool {
+      auto &step = trace[s];
+      auto i = step.instruction;
+      auto &t = i.op.ternary;
+      auto &b = i.op.binary;
+      // the interpreter runs and counts the step instead
+      auto exit = [&] {
+        ip().val = step.at;
+        retired = base + ran;
+        left();
+        return false;
+      };
+      switch (step.kind) {
+      case TraceStep::add_vals:
+      case TraceStep::sub_vals: {
+        auto l = value(t.a), r = value(t.b);
+        if (l.val.is_alloc || r.val.is_alloc) [[unlikely]]
+          return exit();
+        // unsigned and cut to 31 bits like the Word operators
+        Val::Data x = l.val.data, y = r.val.data;
+        auto add = step.kind == TraceStep::add_vals;
+        reg<false>(t.out) = Val(add ? x + y : x - y);
+        return true;
+      }
+      case TraceStep::add_ptr:
+      case TraceStep::sub_ptr: {
+        auto l = value(t.a), r = value(t.b);
+        if (!l.alloc.is_alloc || r.val.is_alloc) [[unlikely]]
+          return exit();
+        Val::Data x = l.alloc.offset, y = r.val.data;
+        auto offset = step.kind == TraceStep::add_ptr ? x + y : x - y;
+        reg<false>(t.out) = Alloc(l.alloc.number, Alloc::Offset(offset));
+        return true;
+      }
+      case TraceStep::mov:
+        reg<false>(b.b.reg.operand) = value(b.a);
+        return true;
+      case TraceStep::branch: {
+        auto zero = value(b.a) == tri::nullw;
+        // the interpreter runs the branch again the other way
+        auto jumps = (i.instruct == InstructionType::jnz) != zero;
+        if (jumps != step.taken) [[unlikely]]
+          return exit();
+        return true;
+      }
+      case TraceStep::jump:
+        return true;
+      case TraceStep::call:
+        rp().val = step.at + 1;
+        return true;
+      case TraceStep::generic:
+        break;
+      }
+      at = step.at;
+      ip().val = at + 1;
+      retired = base + ran + 1;
+      dispatch(i);
+      if (interrupted) [[unlikely]] {
+        // loops inside the trace are already part of it
+        if (!traceEvent || blocked || trapped.code != TrapCode::none)
+          return false;
+        interrupted = traceEvent = false;
+      }
+      auto next = s + 1 == trace.size() ? trace.front().at : trace[s + 1].at;
+      if (ip().val.data != next) [[unlikely]] {
+        left();
+        return false;
+      }
+      return true;
+    };
+    while (step()) {
+      ++ran;
+      s = s + 1 == trace.size() ? 0 : s + 1;
     }
-  }
-}
+    // a trace that keeps failing a guard before it gets around is dropped,
+    // which leaves the reference dangling, so nothing may touch it after
+    if (ran >= trace.size()) {
+      trace.misses = 0;
+    } else if (guardFailed && ++trace.misses == max_misses) {
+      auto head = trace.front().at;
+      traces.erase(head);
+      heat[head] = 0;
+      ++traceStats.discarded;
+    }
+    // a step that left through the interpreter ran too, unless it was
+    // suspended and runs again when resumed
+    traceStats.instructions += retired - base - uint64_t(blocked);
+    if (timeTraces) [[unlikely]]
+      traceStats.time += std::chrono::steady_clock::now() - started;
+  };
 
-Word tri::Interpreter::alloc(uint32_t size) {
-  uint32_t pos = 0;
-  for (auto &i : allocced) {
-    if (!i.all()) {
-      for (unsigned bit = 0; bit != 64; ++bit) {
-        if (!i.test(bit)) {
-          i.set(bit);
-          pos += bit;
+  while (true) {
+    at = ip().val;
+    ++retired;
+    if (Checked && at >= code.size()) [[unlikely]] {
+      raise(TrapCode::ip_range, ip());
+    } else {
+      auto instruction = code[at];
+      ip().val = at + 1;
+      if (Checked && static_cast<uchar>(instruction.instruct) >=
+                         instruction_count) [[unlikely]] {
+        raise(TrapCode::invalid_instruction);
+      } else {
+        switch (tri::operandCount(instruction.instruct)) {
+        case opCount::zero:
+          if (instruction.instruct == tri::InstructionType::hlt)
+            return Status::halted;
+          handleNullary(instruction);
+          break;
+        case opCount::one:
+          handleUnary(instruction);
+          break;
+        case opCount::two:
+          handleBinary(instruction);
+          break;
+        case opCount::three:
+          handleTertiary(instruction);
           break;
         }
       }
-      break;
+      if (debug) {
+        fmt::print("{}: i: {} s: {} b: {} r: {} [{}]\n", log(instruction),
+                   int(ip().val), int(sp().val), int(bp().val), int(rp().val),
+                   fmt::join(std::span(registers).subspan(4), "|"));
+        using namespace std::chrono_literals;
+        std::this_thread::sleep_for(100ms);
+      }
+    }
+    if (interrupted) [[unlikely]] {
+      interrupted = false;
+      if (traceEvent && !blocked && trapped.code == TrapCode::none) {
+        traceEvent = false;
+        auto trace = onTrace(at);
+        if (!trace)
+          continue;
+        runTrace(*trace);
+        if (!interrupted)
+          continue;
+        interrupted = false;
+      }
+      traceEvent = blocked = false;
+      if (!recording.empty())
+        abortRecording();
+      // nothing trapped, so a channel was empty or full. The instruction
+      // runs again when resumed and is only counted then
+      if (trapped.code == TrapCode::none) {
+        ip().val = at;
+        --retired;
+        return Status::suspended;
+      }
+      if (!deliver(at))
+        return Status::trapped;
     }
-    pos += 64;
   }
+}
+
+Word tri::Interpreter::alloc(Val::Data size) {
+  // numbers are as wide as the layout allows, and the lowest free one is
+  // always taken
+  constexpr auto numbers = size_t(1) << WordPolicy::number_bits;
+  auto fits = [&] {
+    return heap().size() < std::min<size_t>(quota.objects, numbers) &&
+           heapWords + size <= quota.heap_words;
+  };
+  if (size > Limits::object_words) [[unlikely]]
+    return raise(TrapCode::memory_quota, Val(size));
+  if (!fits() && quota.collect)
+    clean();
+  if (!fits()) [[unlikely]]
+    return raise(TrapCode::memory_quota, Val(size));
 
-  heap.insert({pos, Allocation(size, false)});
+  auto open = std::ranges::find_if(allocced, [](auto &b) { return !b.all(); });
+  if (open == allocced.end())
+    open = allocced.insert(open, 0);
+  auto bit = std::countr_one(open->to_ullong());
+  uint32_t pos = (open - allocced.begin()) * 64 + bit;
+
+  // the host running out of memory is the budget running out too
+  try {
+    heap().insert({pos, Allocation(arena.resource(), size, false)});
+  } catch (const std::bad_alloc &) {
+    return raise(TrapCode::memory_quota, Val(size));
+  }
+  open->set(bit);
+  heapWords += size;
+  if (profiler) [[unlikely]]
+    sampleAlloc(pos, size);
   return Alloc(pos, 0);
 }
 
-Word &tri::Interpreter::deref(Word ptr) {
-  if (!ptr.val.is_alloc) {
+Word tri::Interpreter::resize(Word ptr, Word size) {
+  if (size.val.is_alloc) [[unlikely]]
+    return raise(TrapCode::alloc_arithmetic, ptr, size);
+  auto find = [&] {
+    return ptr.alloc.is_alloc ? heap().find(ptr.alloc.number) : heap().end();
+  };
+  auto n = find();
+  if (n == heap().end()) [[unlikely]]
+    return raise(TrapCode::invalid_deref, ptr);
+  size_t before = n->second.end(), after = size.val;
+  if (after > Limits::object_words) [[unlikely]]
+    return raise(TrapCode::memory_quota, ptr, size);
+  // only growing counts against the quota
+  auto fits = [&] {
+    return after <= before || heapWords - before + after <= quota.heap_words;
+  };
+  if (!fits() && quota.collect) {
+    clean();
+    n = find();
+    if (n == heap().end()) [[unlikely]]
+      return raise(TrapCode::invalid_deref, ptr);
+  }
+  if (!fits()) [[unlikely]]
+    return raise(TrapCode::memory_quota, ptr, size);
+  // Growing stays in place while the words' capacity lasts, otherwise they
+  // move to a bigger block. Sites point at the Allocation and check bounds
+  // on every use, so none of them go stale.
+  try {
+    n->second.own(arena.resource()).resize(after);
+  } catch (const std::bad_alloc &) {
+    return raise(TrapCode::memory_quota, ptr, size);
+  }
+  heapWords = heapWords - before + after;
+  return Alloc(ptr.alloc.number, 0);
+}
+
+bool tri::Interpreter::grow(size_t size) {
+  if (size > dataWords + stack.size()) {
+    if (size > quota.stack_words) [[unlikely]]
+      return false;
+    if (debug) {
+      std::cout << "resized stack to " << size - 1 << '\n';
+    }
     try {
-      if (ptr.val >= stack.size()) {
-        if (debug) {
-          std::cout << "resized stack to " << ptr.val.data << '\n';
-        }
-        stack.resize(ptr.val + 1);
-      }
-      return stack.at(ptr.val);
-    } catch (const std::out_of_range &e) {
-      std::cerr << "invalid stack dereference at " << ptr.val.data << " (max "
-                << stack.size() << ")\n";
-      std::exit(1);
+      stack.resize(size - dataWords);
+    } catch (const std::bad_alloc &) {
+      return false;
     }
+  }
+  return true;
+}
+
+template <bool Write> Word &tri::Interpreter::dataWord(size_t address) {
+  auto &page = data[address / Program::page_words];
+  if constexpr (Write) {
+    if (page.use_count() > 1)
+      page = std::make_shared<std::vector<Word>>(*page);
+  }
+  // reads never write through this, so a shared page is left shared
+  return (*page)[address % Program::page_words];
+}
+
+void tri::Interpreter::flatten() {
+  std::vector<Word> words;
+  words.reserve(dataWords + stack.size());
+  for (auto &page : data)
+    words.insert(words.end(), page->begin(), page->end());
+  words.insert(words.end(), stack.begin(), stack.end());
+  stack = std::move(words);
+  data.clear();
+  dataWords = 0;
+}
+
+template <bool Write> Word &tri::Interpreter::deref(Word ptr) {
+  if (!ptr.val.is_alloc) {
+    if (ptr.val < dataWords)
+      return dataWord<Write>(ptr.val);
+    if (!grow(size_t(ptr.val) + 1)) [[unlikely]]
+      return raise(TrapCode::memory_quota, ptr);
+    return stack[ptr.val - dataWords];
+  }
+  auto n = heap().find(ptr.alloc.number);
+  if (n == heap().end() || !n->second.inRange(ptr.alloc)) [[unlikely]]
+    return raise(TrapCode::invalid_deref, ptr);
+  if constexpr (Write)
+    return n->second.own(arena.resource())[ptr.alloc.offset];
+  else
+    return (*n->second.data)[ptr.alloc.offset];
+}
+
+template <bool Write>
+Word &tri::Interpreter::deref(Word ptr, HeapSite &site) {
+  if (!ptr.val.is_alloc)
+    return deref<Write>(ptr);
+  if (site.epoch != epoch || site.number != ptr.alloc.number) [[unlikely]] {
+    ++cacheStats.misses;
+    auto n = heap().find(ptr.alloc.number);
+    if (n == heap().end()) [[unlikely]]
+      return raise(TrapCode::invalid_deref, ptr);
+    // unordered_map nodes stay put until they're erased
+    site = {ptr.alloc.number, epoch, &n->second};
   } else {
-    auto n = heap.find(ptr.alloc.number);
-    if (n != heap.end())
-      return n->second.data[ptr.alloc.offset];
+    ++cacheStats.hits;
+  }
+  auto &alloc = *site.alloc;
+  if (!alloc.inRange(ptr.alloc)) [[unlikely]]
+    return raise(TrapCode::invalid_deref, ptr);
+  if constexpr (Write)
+    return alloc.own(arena.resource())[ptr.alloc.offset];
+  else
+    return (*alloc.data)[ptr.alloc.offset];
+}
+
+template <bool Write>
+std::span<Word> tri::Interpreter::range(Word ptr, Val::Data len) {
+  if (!ptr.val.is_alloc) {
+    if (ptr.val < dataWords) {
+      // a range inside one data page is used in place, anything else that
+      // touches data needs it in one piece
+      auto end = size_t(ptr.val) + len;
+      if (len != 0 && end <= dataWords &&
+          ptr.val / Program::page_words == (end - 1) / Program::page_words)
+        return std::span(&dataWord<Write>(ptr.val), len);
+      flatten();
+    }
+    if (!grow(size_t(ptr.val) + len)) [[unlikely]] {
+      raise(TrapCode::memory_quota, ptr, Val(len));
+      return {};
+    }
+    return std::span(stack).subspan(ptr.val - dataWords, len);
+  }
+  auto n = heap().find(ptr.alloc.number);
+  if (n == heap().end() || size_t(ptr.alloc.offset) + len > n->second.end())
+      [[unlikely]] {
+    raise(TrapCode::invalid_deref, ptr, Val(len));
+    return {};
   }
-  throw std::runtime_error("invalid derefence");
+  if constexpr (Write)
+    return std::span(n->second.own(arena.resource()))
+        .subspan(ptr.alloc.offset, len);
+  else
+    return std::span(*n->second.data).subspan(ptr.alloc.offset, len);
 }
 
 void tri::Interpreter::clean() {
@@ -222,50 +935,53 @@ void tri::Interpreter::clean() {
   if (marks.size() < allocced.size()) {
     marks.resize(allocced.size(), 0);
   }
-  auto wasSeen = [&](uint16_t index) -> bool {
+  auto wasSeen = [&](uint32_t index) -> bool {
     return marks[index / 64].test(index % 64);
   };
-  auto hasSeen = [&](uint16_t index) { marks[index / 64].set(index % 64); };
-  auto markAlloc = [&](Alloc a, auto &&self) {
+  auto hasSeen = [&](uint32_t index) { marks[index / 64].set(index % 64); };
+  // a worklist instead of recursion, a long list would overflow the stack
+  std::vector<uint32_t> pending;
+  auto markAlloc = [&](Alloc a) {
     if (wasSeen(a.number))
       return;
-    auto &alloc = heap.at(a.number);
     hasSeen(a.number);
-    for (auto w : alloc.data) {
-      if (w.alloc.is_alloc) {
-        self(w.alloc, self);
-      }
-    }
+    pending.push_back(a.number);
   };
-  // scans stack
-  if (!stack.empty())
-    for (auto w : std::span(stack.begin(), sp().val + 1)) {
+  roots([&](Alloc a, Via) { markAlloc(a); });
+  while (!pending.empty()) {
+    auto number = pending.back();
+    pending.pop_back();
+    for (auto w : *heap().at(number).data) {
       if (w.alloc.is_alloc) {
-        markAlloc(w.alloc, markAlloc);
+        markAlloc(w.alloc);
       }
     }
-  // scans registers
-  for (auto w : registers) {
-    if (w.alloc.is_alloc) {
-      markAlloc(w.alloc, markAlloc);
-    }
   }
+  if (profiler)
+    profileClean();
   // sweeps
-  for (auto i = heap.begin(), last = heap.end(); i != last;) {
+  bool freed = false;
+  for (auto i = heap().begin(), last = heap().end(); i != last;) {
     if (!wasSeen(i->first)) {
       allocced[i->first / 64].reset(i->first % 64);
-      i = heap.erase(i);
+      heapWords -= i->second.end();
+      i = heap().erase(i);
+      freed = true;
     } else {
       ++i;
     }
   }
   marks.clear();
   marks.resize(allocced.size(), 0);
+  if (freed)
+    ++epoch;
+  if (profiler && profiler->options.on_clean)
+    profiler->options.on_clean(heapProfile);
 }
 size_t tri::Interpreter::mem_consumption() const noexcept {
   size_t sum = 0;
-  for (auto &[_, alloc] : heap) {
-    sum += alloc.data.size();
+  for (auto &[_, alloc] : heap()) {
+    sum += alloc.data->size();
   }
   return sum;
 }
\ No newline at end of file
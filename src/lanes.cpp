@@ -0,0 +1,164 @@
+#include "lanes.hpp"
+#include "tri/asm.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define TRI_X86_LANES
+#endif
+
+using namespace tri;
+using tri::detail::LaneKernels;
+
+namespace {
+// lanes are Vals, so every result is cut down to 31 bits
+constexpr uint32_t val_mask = (1u << 31) - 1;
+
+namespace scalar {
+template <typename Op> void apply(Lanes &out, const Lanes &a, const Lanes &b) {
+  for (size_t i = 0; i != lane_count; ++i)
+    out[i] = Op{}(a[i], b[i]) & val_mask;
+}
+struct Min {
+  uint32_t operator()(uint32_t a, uint32_t b) const { return std::min(a, b); }
+};
+struct Max {
+  uint32_t operator()(uint32_t a, uint32_t b) const { return std::max(a, b); }
+};
+struct Equal {
+  uint32_t operator()(uint32_t a, uint32_t b) const { return a == b; }
+};
+
+uint32_t sum(const Lanes &a) {
+  uint32_t total = 0;
+  for (auto l : a)
+    total += l;
+  return total & val_mask;
+}
+uint32_t hmin(const Lanes &a) { return *std::min_element(a.begin(), a.end()); }
+uint32_t hmax(const Lanes &a) { return *std::max_element(a.begin(), a.end()); }
+
+constexpr LaneKernels kernels = {
+    "scalar",
+    apply<std::plus<uint32_t>>,
+    apply<std::minus<uint32_t>>,
+    apply<std::multiplies<uint32_t>>,
+    apply<Min>,
+    apply<Max>,
+    apply<Equal>,
+    sum,
+    hmin,
+    hmax};
+} // namespace scalar
+
+#ifdef TRI_X86_LANES
+// loadu/storeu since Lanes only has uint32_t alignment
+namespace sse {
+#define TRI_SSE [[gnu::target("sse4.1")]]
+template <__m128i (*Op)(__m128i, __m128i)>
+TRI_SSE void apply(Lanes &out, const Lanes &a, const Lanes &b) {
+  auto mask = _mm_set1_epi32(val_mask);
+  for (size_t i = 0; i != lane_count; i += 4) {
+    auto l = _mm_loadu_si128(reinterpret_cast<const __m128i *>(&a[i]));
+    auto r = _mm_loadu_si128(reinterpret_cast<const __m128i *>(&b[i]));
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(&out[i]),
+                     _mm_and_si128(Op(l, r), mask));
+  }
+}
+TRI_SSE __m128i add(__m128i a, __m128i b) { return _mm_add_epi32(a, b); }
+TRI_SSE __m128i sub(__m128i a, __m128i b) { return _mm_sub_epi32(a, b); }
+TRI_SSE __m128i mul(__m128i a, __m128i b) { return _mm_mullo_epi32(a, b); }
+TRI_SSE __m128i min(__m128i a, __m128i b) { return _mm_min_epu32(a, b); }
+TRI_SSE __m128i max(__m128i a, __m128i b) { return _mm_max_epu32(a, b); }
+TRI_SSE __m128i cmp(__m128i a, __m128i b) {
+  return _mm_srli_epi32(_mm_cmpeq_epi32(a, b), 31);
+}
+#undef TRI_SSE
+
+constexpr LaneKernels kernels = {
+    "sse4.1",
+    apply<add>,
+    apply<sub>,
+    apply<mul>,
+    apply<min>,
+    apply<max>,
+    apply<cmp>,
+    scalar::sum,
+    scalar::hmin,
+    scalar::hmax};
+} // namespace sse
+
+namespace avx2 {
+#define TRI_AVX2 [[gnu::target("avx2")]]
+template <__m256i (*Op)(__m256i, __m256i)>
+TRI_AVX2 void apply(Lanes &out, const Lanes &a, const Lanes &b) {
+  static_assert(lane_count == 8, "one ymm register per vector");
+  auto l = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(a.data()));
+  auto r = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(b.data()));
+  auto mask = _mm256_set1_epi32(val_mask);
+  _mm256_storeu_si256(reinterpret_cast<__m256i *>(out.data()),
+                      _mm256_and_si256(Op(l, r), mask));
+}
+TRI_AVX2 __m256i add(__m256i a, __m256i b) { return _mm256_add_epi32(a, b); }
+TRI_AVX2 __m256i sub(__m256i a, __m256i b) { return _mm256_sub_epi32(a, b); }
+TRI_AVX2 __m256i mul(__m256i a, __m256i b) {
+  return _mm256_mullo_epi32(a, b);
+}
+TRI_AVX2 __m256i min(__m256i a, __m256i b) { return _mm256_min_epu32(a, b); }
+TRI_AVX2 __m256i max(__m256i a, __m256i b) { return _mm256_max_epu32(a, b); }
+TRI_AVX2 __m256i cmp(__m256i a, __m256i b) {
+  return _mm256_srli_epi32(_mm256_cmpeq_epi32(a, b), 31);
+}
+
+TRI_AVX2 uint32_t sum(const Lanes &a) {
+  auto v = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(a.data()));
+  auto half = _mm_add_epi32(_mm256_castsi256_si128(v),
+                            _mm256_extracti128_si256(v, 1));
+  half = _mm_add_epi32(half, _mm_shuffle_epi32(half, 0b01001110));
+  half = _mm_add_epi32(half, _mm_shuffle_epi32(half, 0b10110001));
+  return uint32_t(_mm_cvtsi128_si32(half)) & val_mask;
+}
+#undef TRI_AVX2
+
+constexpr LaneKernels kernels = {
+    "avx2",
+    apply<add>,
+    apply<sub>,
+    apply<mul>,
+    apply<min>,
+    apply<max>,
+    apply<cmp>,
+    sum,
+    scalar::hmin,
+    scalar::hmax};
+} // namespace avx2
+#endif
+
+const LaneKernels &pick() noexcept {
+#ifdef TRI_X86_LANES
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2"))
+    return avx2::kernels;
+  if (__builtin_cpu_supports("sse4.1"))
+    return sse::kernels;
+#endif
+  return scalar::kernels;
+}
+} // namespace
+
+namespace tri::inline TRI_LAYOUT::detail {
+const LaneKernels &laneKernels() noexcept {
+  static const LaneKernels &kernels = pick();
+  return kernels;
+}
+} // namespace tri::inline TRI_LAYOUT::detail
+
+namespace tri::inline TRI_LAYOUT {
+const char *lane_implementation() noexcept {
+  return detail::laneKernels().name;
+}
+} // namespace tri::inline TRI_LAYOUT
@@ -0,0 +1,20 @@
+#pragma once
+
+#include "tri/asm.hpp"
+
+#include <cstdint>
+
+// the lane kernels are picked for the host cpu when first used
+namespace tri::inline TRI_LAYOUT::detail {
+using LaneOp = void (*)(Lanes &out, const Lanes &a, const Lanes &b);
+using LaneReduction = uint32_t (*)(const Lanes &a);
+
+struct LaneKernels {
+  const char *name;
+  LaneOp add, sub, mul, min, max, cmp;
+  LaneReduction sum, hmin, hmax;
+};
+
+// AVX2 or SSE4.1 when the cpu has them, plain loops otherwise
+const LaneKernels &laneKernels() noexcept;
+} // namespace tri::inline TRI_LAYOUT::detail
@@ -0,0 +1,689 @@
+#include "assembler.hpp"
+#include "tri/asm.hpp"
+
+#include <array>
+#include <bitset>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+using namespace tri;
+using tri::detail::Code;
+using tri::detail::Globals;
+using tri::detail::Labels;
+using tri::detail::literal_mask;
+using tri::detail::UnfinishedInstruction;
+
+namespace {
+
+struct Arg {
+  enum struct Kind : uchar { none, reg, imm, label };
+  Kind kind = Kind::none;
+  Register reg = Register::invalid;
+  uint32_t imm = 0;
+  std::string text;
+
+  static Arg of(Register r) {
+    return {Kind::reg, r, 0, std::string(register_names.at(r))};
+  }
+  static Arg of(uint32_t i) {
+    return {Kind::imm, Register::invalid, i, std::to_string(i)};
+  }
+  bool is(Register r) const noexcept { return kind == Kind::reg && reg == r; }
+};
+
+struct Node {
+  InstructionType instruct;
+  std::array<Arg, 3> args;
+};
+
+using Nodes = std::vector<Node>;
+
+Arg parseArg(const std::string &s, const Labels &labels,
+             const Globals &globals) {
+  // same lookup order as the assembler itself
+  Arg arg{.text = s};
+  if (s.empty())
+    return arg;
+  if (auto reg = register_table.find(s); reg != register_table.end()) {
+    arg.kind = Arg::Kind::reg;
+    arg.reg = reg->second;
+  } else if (auto global = globals.find(s); global != globals.end()) {
+    arg.kind = Arg::Kind::imm;
+    arg.imm = global->second & literal_mask;
+  } else if (labels.contains(s)) {
+    arg.kind = Arg::Kind::label;
+  } else {
+    arg.kind = Arg::Kind::imm;
+    arg.imm = tri::detail::number(s).value_or(0) & literal_mask;
+  }
+  return arg;
+}
+
+// the bulk memory instructions have three operands too but aren't this
+bool isArithmetic(InstructionType i) {
+  switch (i) {
+  case InstructionType::addi:
+  case InstructionType::subi:
+  case InstructionType::muli:
+  case InstructionType::divi:
+    return true;
+  default:
+    return false;
+  }
+}
+
+// the operand holding the jump target, if the instruction has one
+const Arg *target(const Node &n) {
+  switch (n.instruct) {
+  case InstructionType::jmp:
+  case InstructionType::call:
+    return &n.args[0];
+  case InstructionType::jnz:
+  case InstructionType::jez:
+    return &n.args[1];
+  default:
+    return nullptr;
+  }
+}
+
+Arg *target(Node &n) {
+  return const_cast<Arg *>(target(static_cast<const Node &>(n)));
+}
+
+// ret jumps through rp, like jmp rp
+bool isIndirect(const Node &n) {
+  if (n.instruct == InstructionType::ret)
+    return true;
+  auto t = target(n);
+  return t != nullptr && t->kind == Arg::Kind::reg;
+}
+
+bool optimizable(const Nodes &nodes) {
+  for (auto &n : nodes) {
+    for (auto &a : n.args) {
+      if (a.is(Register::ip))
+        return false;
+    }
+    auto t = target(n);
+    if (t != nullptr && t->kind == Arg::Kind::imm)
+      return false;
+    if (isArithmetic(n.instruct)) {
+      for (auto &a : {n.args[0], n.args[1]}) {
+        if (a.kind == Arg::Kind::label || a.is(Register::rp))
+          return false;
+      }
+    }
+  }
+  return true;
+}
+
+class Graph {
+public:
+  Nodes nodes;
+  Labels &labels;
+  OptimizeStats &stats;
+
+  Graph(Nodes n, Labels &l, OptimizeStats &s)
+      : nodes(std::move(n)), labels(l), stats(s) {}
+
+  bool unreachable();
+  bool propagate();
+  bool deadStores();
+  bool thread();
+  void compact();
+
+private:
+  std::vector<bool> dead;
+  bool indirect = false;
+  std::vector<bool> entry;
+
+  size_t at(const Arg &label) const { return labels.at(label.text); }
+  void analyze();
+  std::vector<size_t> successors(size_t i) const;
+  void kill(size_t i) {
+    if (!dead[i] && i + 1 != nodes.size()) {
+      dead[i] = true;
+    }
+  }
+};
+
+// Instructions an indirect jump can land on: labels whose address is used as
+// a value and the return points of calls. The entry point is always one.
+void Graph::analyze() {
+  dead.assign(nodes.size(), false);
+  entry.assign(nodes.size(), false);
+  entry[0] = true;
+  indirect = false;
+  for (size_t i = 0; i != nodes.size(); ++i) {
+    auto &n = nodes[i];
+    indirect |= isIndirect(n);
+    if (n.instruct == InstructionType::call && i + 1 != nodes.size())
+      entry[i + 1] = true;
+    auto t = target(n);
+    for (auto &a : n.args) {
+      if (a.kind == Arg::Kind::label && &a != t)
+        entry[at(a)] = true;
+    }
+  }
+}
+
+std::vector<size_t> Graph::successors(size_t i) const {
+  auto &n = nodes[i];
+  std::vector<size_t> next;
+  auto t = target(n);
+  if (t != nullptr && t->kind == Arg::Kind::label)
+    next.push_back(at(*t));
+  // hlt falls through since execute() resumes after it
+  if (n.instruct != InstructionType::jmp &&
+      n.instruct != InstructionType::ret && i + 1 != nodes.size())
+    next.push_back(i + 1);
+  return next;
+}
+
+bool Graph::unreachable() {
+  analyze();
+  std::vector<bool> seen(nodes.size());
+  std::deque<size_t> work;
+  for (size_t i = 0; i != nodes.size(); ++i) {
+    if (i == 0 || (indirect && entry[i]))
+      work.push_back(i);
+  }
+  while (!work.empty()) {
+    auto i = work.front();
+    work.pop_front();
+    if (seen[i])
+      continue;
+    seen[i] = true;
+    for (auto s : successors(i))
+      work.push_back(s);
+  }
+  bool changed = false;
+  for (size_t i = 0; i != nodes.size(); ++i) {
+    if (!seen[i] && i + 1 != nodes.size()) {
+      kill(i);
+      ++stats.unreachable;
+      changed = true;
+    }
+  }
+  compact();
+  return changed;
+}
+
+struct Fact {
+  enum struct Kind : uchar { unknown, constant, copy };
+  Kind kind = Kind::unknown;
+  uint32_t value = 0;
+  Register of = Register::invalid;
+  bool operator==(const Fact &) const = default;
+};
+using State = std::array<Fact, register_count>;
+
+Fact &fact(State &s, Register r) { return s[static_cast<uchar>(r)]; }
+
+void clobber(State &s, Register r) {
+  fact(s, r) = {};
+  for (auto &f : s) {
+    if (f.kind == Fact::Kind::copy && f.of == r)
+      f = {};
+  }
+}
+
+Fact valueOf(State &s, const Arg &a) {
+  switch (a.kind) {
+  case Arg::Kind::imm:
+    return {Fact::Kind::constant, a.imm};
+  case Arg::Kind::reg: {
+    auto f = fact(s, a.reg);
+    if (f.kind != Fact::Kind::unknown)
+      return f;
+    return {Fact::Kind::copy, 0, a.reg};
+  }
+  default:
+    return {};
+  }
+}
+
+void assign(State &s, Register r, Fact f) {
+  clobber(s, r);
+  if (f.kind == Fact::Kind::copy && f.of == r)
+    f = {};
+  fact(s, r) = f;
+}
+
+// evaluates with the interpreter's own operators so folding can't disagree.
+// wide words can produce values past 31 bits, which are left to run
+std::optional<uint32_t> fold(InstructionType i, uint32_t l, uint32_t r) {
+  auto a = Word(Val(l)), b = Word(Val(r));
+  Val::Data v;
+  switch (i) {
+  case InstructionType::addi:
+    v = (a + b).val.data;
+    break;
+  case InstructionType::subi:
+    v = (a - b).val.data;
+    break;
+  case InstructionType::muli:
+    v = (a * b).val.data;
+    break;
+  case InstructionType::divi:
+    v = (a / b).val.data;
+    break;
+  default:
+    throw std::logic_error("folding a non-arithmetic instruction");
+  }
+  if (v >> 31)
+    return std::nullopt;
+  return uint32_t(v);
+}
+
+void transfer(const Node &n, State &s) {
+  auto &[a, b, out] = n.args;
+  switch (n.instruct) {
+  case InstructionType::addi:
+  case InstructionType::subi:
+  case InstructionType::muli:
+  case InstructionType::divi: {
+    auto l = valueOf(s, a), r = valueOf(s, b);
+    std::optional<uint32_t> v;
+    if (l.kind == Fact::Kind::constant && r.kind == Fact::Kind::constant)
+      v = fold(n.instruct, l.value, r.value);
+    if (v)
+      assign(s, out.reg, {Fact::Kind::constant, *v});
+    else
+      clobber(s, out.reg);
+    return;
+  }
+  case InstructionType::mov:
+    assign(s, b.reg, valueOf(s, a));
+    return;
+  case InstructionType::in:
+  case InstructionType::ldc:
+    clobber(s, a.reg);
+    return;
+  case InstructionType::alloc:
+  case InstructionType::load:
+  case InstructionType::recv:
+  case InstructionType::vsum:
+  case InstructionType::vhmin:
+  case InstructionType::vhmax:
+    clobber(s, b.reg);
+    return;
+  case InstructionType::call:
+    clobber(s, Register::rp);
+    return;
+  case InstructionType::mcmp:
+  case InstructionType::realloc:
+    clobber(s, out.reg);
+    return;
+  case InstructionType::pop:
+    clobber(s, a.reg);
+    clobber(s, Register::sp);
+    return;
+  case InstructionType::push:
+    clobber(s, Register::sp);
+    return;
+  case InstructionType::enter:
+  case InstructionType::leave:
+    clobber(s, Register::sp);
+    clobber(s, Register::bp);
+    clobber(s, Register::rp);
+    return;
+  default:
+    return;
+  }
+}
+
+// Forward dataflow of register constants and copies, then rewrites operands
+// with what is known on entry to each instruction.
+bool Graph::propagate() {
+  analyze();
+  std::vector<std::optional<State>> in(nodes.size());
+  std::deque<size_t> work;
+  for (size_t i = 0; i != nodes.size(); ++i) {
+    if (entry[i]) {
+      in[i] = State{};
+      work.push_back(i);
+    }
+  }
+  while (!work.empty()) {
+    auto i = work.front();
+    work.pop_front();
+    auto s = *in[i];
+    transfer(nodes[i], s);
+    for (auto next : successors(i)) {
+      if (entry[next])
+        continue;
+      if (!in[next]) {
+        in[next] = s;
+        work.push_back(next);
+        continue;
+      }
+      auto merged = *in[next];
+      for (size_t r = 0; r != register_count; ++r) {
+        if (merged[r] != s[r])
+          merged[r] = {};
+      }
+      if (merged != *in[next]) {
+        in[next] = merged;
+        work.push_back(next);
+      }
+    }
+  }
+
+  bool changed = false;
+  for (size_t i = 0; i != nodes.size(); ++i) {
+    if (!in[i])
+      continue;
+    auto &s = *in[i];
+    auto &n = nodes[i];
+    auto &[a, b, out] = n.args;
+    // register reads become a constant when it fits a narrow literal, or
+    // the register it was copied from
+    auto replace = [&](Arg &arg, bool constants) {
+      if (arg.kind != Arg::Kind::reg)
+        return false;
+      auto f = fact(s, arg.reg);
+      if (constants && f.kind == Fact::Kind::constant &&
+          Literal::fits(f.value)) {
+        arg = Arg::of(f.value);
+      } else if (f.kind == Fact::Kind::copy) {
+        arg = Arg::of(f.of);
+      } else {
+        return false;
+      }
+      return true;
+    };
+    auto substitute = [&](Arg &arg, bool constants) {
+      if (replace(arg, constants)) {
+        ++stats.propagated;
+        changed = true;
+      }
+    };
+
+    switch (n.instruct) {
+    case InstructionType::addi:
+    case InstructionType::subi:
+    case InstructionType::muli:
+    case InstructionType::divi: {
+      auto l = valueOf(s, a), r = valueOf(s, b);
+      std::optional<uint32_t> v;
+      if (l.kind == Fact::Kind::constant && r.kind == Fact::Kind::constant)
+        v = fold(n.instruct, l.value, r.value);
+      if (v) {
+        n = Node{InstructionType::mov, {Arg::of(*v), out, Arg{}}};
+        ++stats.folded;
+        changed = true;
+        break;
+      }
+      auto before = n;
+      auto replaced = int(replace(a, true)) + int(replace(b, true));
+      // a pooled literal is loaded into out, so out can't become a source
+      for (auto [lit, other] : {std::pair{&a, &b}, std::pair{&b, &a}}) {
+        if (lit->kind == Arg::Kind::imm && !Literal::fits(lit->imm) &&
+            other->is(out.reg)) {
+          n = before;
+          replaced = 0;
+        }
+      }
+      stats.propagated += replaced;
+      changed |= replaced != 0;
+      break;
+    }
+    case InstructionType::mov:
+      substitute(a, true);
+      if (a.is(b.reg)) {
+        kill(i);
+        ++stats.dead;
+        changed = true;
+      }
+      break;
+    case InstructionType::jnz:
+    case InstructionType::jez: {
+      substitute(a, true);
+      if (a.kind != Arg::Kind::imm)
+        break;
+      bool taken = (a.imm != 0) == (n.instruct == InstructionType::jnz);
+      if (taken)
+        n = Node{InstructionType::jmp, {b, Arg{}, Arg{}}};
+      else
+        kill(i);
+      ++stats.folded;
+      changed = true;
+      break;
+    }
+    case InstructionType::alloc:
+    case InstructionType::load:
+    case InstructionType::recv:
+      substitute(a, true);
+      break;
+    case InstructionType::send:
+      substitute(a, true);
+      substitute(b, true);
+      break;
+    case InstructionType::store:
+      substitute(a, true);
+      substitute(b, false);
+      break;
+    case InstructionType::out:
+    case InstructionType::jmp:
+    case InstructionType::call:
+      substitute(a, false);
+      break;
+    case InstructionType::push:
+    case InstructionType::enter:
+    case InstructionType::vld:
+    case InstructionType::vset:
+      substitute(a, true);
+      break;
+    case InstructionType::vst:
+      substitute(b, true);
+      break;
+    case InstructionType::mcpy:
+    case InstructionType::mset:
+    case InstructionType::mcmp:
+    case InstructionType::realloc:
+      substitute(a, true);
+      substitute(b, true);
+      break;
+    case InstructionType::noop:
+      kill(i);
+      ++stats.dead;
+      changed = true;
+      break;
+    default:
+      break;
+    }
+  }
+  compact();
+  return changed;
+}
+
+// Backward liveness of registers; pure register writes nobody reads are
+// dropped. Calls and indirect jumps keep every register live, and so does hlt
+// since clean() scans the registers for roots between runs.
+bool Graph::deadStores() {
+  analyze();
+  using Live = std::bitset<register_count>;
+  auto all = Live().set();
+  auto bit = [](Register r) { return static_cast<size_t>(r); };
+  std::vector<Live> live(nodes.size());
+
+  auto liveIn = [&](size_t i) {
+    auto &n = nodes[i];
+    auto &[a, b, out] = n.args;
+    if (n.instruct == InstructionType::hlt ||
+        n.instruct == InstructionType::call || isIndirect(n))
+      return all;
+    Live after;
+    for (auto s : successors(i))
+      after |= live[s];
+    auto read = [&](const Arg &arg) {
+      if (arg.kind == Arg::Kind::reg)
+        after.set(bit(arg.reg));
+    };
+    switch (n.instruct) {
+    case InstructionType::addi:
+    case InstructionType::subi:
+    case InstructionType::muli:
+    case InstructionType::divi:
+      after.reset(bit(out.reg));
+      read(a);
+      read(b);
+      break;
+    case InstructionType::mov:
+    case InstructionType::alloc:
+    case InstructionType::load:
+    case InstructionType::recv:
+    case InstructionType::vsum:
+    case InstructionType::vhmin:
+    case InstructionType::vhmax:
+      after.reset(bit(b.reg));
+      read(a);
+      break;
+    case InstructionType::in:
+    case InstructionType::ldc:
+      after.reset(bit(a.reg));
+      break;
+    case InstructionType::pop:
+    case InstructionType::push:
+    case InstructionType::enter:
+    case InstructionType::leave:
+      // frames are built from sp, bp and rp without naming them
+      if (n.instruct == InstructionType::pop)
+        after.reset(bit(a.reg));
+      else
+        read(a);
+      for (auto r : {Register::sp, Register::bp, Register::rp})
+        after.set(bit(r));
+      break;
+    default:
+      for (auto &arg : n.args)
+        read(arg);
+      break;
+    }
+    return after;
+  };
+
+  for (bool changed = true; changed;) {
+    changed = false;
+    for (size_t i = nodes.size(); i-- != 0;) {
+      auto l = liveIn(i);
+      if (l != live[i]) {
+        live[i] = l;
+        changed = true;
+      }
+    }
+  }
+
+  bool changed = false;
+  for (size_t i = 0; i != nodes.size(); ++i) {
+    auto &n = nodes[i];
+    Register written;
+    if (isArithmetic(n.instruct))
+      written = n.args[2].reg;
+    else if (n.instruct == InstructionType::mov)
+      written = n.args[1].reg;
+    else
+      continue;
+    Live after;
+    for (auto s : successors(i))
+      after |= live[s];
+    if (!after.test(bit(written))) {
+      kill(i);
+      ++stats.dead;
+      changed = true;
+    }
+  }
+  compact();
+  return changed;
+}
+
+// Jumps to a jmp go straight to its target, jumps to the next instruction
+// are dropped.
+bool Graph::thread() {
+  analyze();
+  bool changed = false;
+  for (size_t i = 0; i != nodes.size(); ++i) {
+    auto &n = nodes[i];
+    auto t = target(n);
+    if (t == nullptr || t->kind != Arg::Kind::label)
+      continue;
+    std::unordered_set<std::string> visited{t->text};
+    for (auto *hop = &nodes[at(*t)];
+         hop->instruct == InstructionType::jmp &&
+         hop->args[0].kind == Arg::Kind::label &&
+         visited.insert(hop->args[0].text).second;
+         hop = &nodes[at(*t)]) {
+      *t = hop->args[0];
+      ++stats.threaded;
+      changed = true;
+    }
+    if (n.instruct != InstructionType::call && at(*t) == i + 1) {
+      kill(i);
+      ++stats.threaded;
+      changed = true;
+    }
+  }
+  compact();
+  return changed;
+}
+
+// Drops dead instructions; a label on a dead instruction moves to the next
+// live one, which is where control would have ended up anyway.
+void Graph::compact() {
+  std::vector<size_t> index(nodes.size());
+  Nodes live;
+  for (size_t i = 0; i != nodes.size(); ++i) {
+    index[i] = live.size();
+    if (!dead[i])
+      live.push_back(std::move(nodes[i]));
+  }
+  for (auto &[_, pos] : labels)
+    pos = index[pos];
+  nodes = std::move(live);
+  dead.assign(nodes.size(), false);
+}
+
+} // namespace
+
+namespace tri::inline TRI_LAYOUT::detail {
+void optimize(Code &code, Labels &labels, const Globals &globals,
+              OptimizeStats &stats) {
+  stats.before = stats.after = code.size();
+  Nodes nodes;
+  nodes.reserve(code.size());
+  for (auto &c : code) {
+    nodes.push_back(Node{c.instruct,
+                         {parseArg(c.a, labels, globals),
+                          parseArg(c.b, labels, globals),
+                          parseArg(c.out, labels, globals)}});
+  }
+  if (nodes.empty() || !optimizable(nodes))
+    return;
+
+  auto p = Graph(std::move(nodes), labels, stats);
+  // each pass can open up work for the others
+  for (int round = 0; round != 16; ++round) {
+    bool changed = p.unreachable();
+    changed |= p.propagate();
+    changed |= p.deadStores();
+    changed |= p.thread();
+    if (!changed)
+      break;
+  }
+
+  code.clear();
+  for (auto &n : p.nodes) {
+    code.push_back(UnfinishedInstruction{
+        n.instruct, n.args[0].text, n.args[1].text, n.args[2].text});
+  }
+  stats.after = code.size();
+}
+} // namespace tri::inline TRI_LAYOUT::detail
@@ -0,0 +1,207 @@
+#include "fmt/format.h"
+#include "tri/asm.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+using namespace tri;
+
+// exponentially distributed, so allocations are sampled as a Poisson process
+// over the words allocated
+double tri::Interpreter::Profiler::nextSample() {
+  random ^= random << 13;
+  random ^= random >> 7;
+  random ^= random << 17;
+  // in (0, 1], log never sees 0
+  auto u = double((random >> 11) + 1) * 0x1p-53;
+  return -std::log(u) * double(options.sample_words);
+}
+
+void tri::Interpreter::profile_heap(std::optional<HeapProfiling> options) {
+  heapProfile = {};
+  if (!options) {
+    profiler.reset();
+    return;
+  }
+  options->sample_words = std::max<size_t>(options->sample_words, 1);
+  auto &p = profiler.emplace();
+  p.options = std::move(*options);
+  p.untilSample = p.nextSample();
+}
+
+void tri::Interpreter::sampleAlloc(uint32_t number, size_t words) {
+  auto &p = *profiler;
+  // empty objects still cost a number, they count as a word
+  auto size = double(std::max<size_t>(words, 1));
+  auto mean = double(p.options.sample_words);
+  double scale = 1;
+  if (mean > 1) {
+    p.untilSample -= size;
+    if (p.untilSample > 0)
+      return;
+    p.untilSample = p.nextSample();
+    // big objects are sampled more often, so each stands for fewer
+    scale = 1 / -std::expm1(-size / mean);
+  }
+  // ip is already past the alloc
+  auto at = uint32_t(ip().val) - 1;
+  p.samples[number] = {at, p.collections, scale};
+  ++p.sites[at].sampled;
+}
+
+void tri::Interpreter::profileClean() {
+  auto &p = *profiler;
+  auto alive = [&](uint32_t n) { return marks[n / 64].test(n % 64); };
+
+  // sites are named after the label before them
+  std::vector<std::pair<uint32_t, std::string_view>> labels;
+  for (auto &[name, address] : program.labels())
+    labels.emplace_back(address, name);
+  std::ranges::sort(labels);
+  auto where = [&](uint32_t ip) {
+    auto after = std::ranges::upper_bound(
+        labels, ip, {}, [](auto &label) { return label.first; });
+    if (after == labels.begin())
+      return fmt::format("ip {}", ip);
+    auto &[address, name] = *std::prev(after);
+    if (address == ip)
+      return std::string(name);
+    return fmt::format("{}+{}", name, ip - address);
+  };
+
+  // the biggest live sample from each site, the oldest of those, is the one
+  // whose path gets reported
+  struct Biggest {
+    size_t words;
+    uint64_t birth;
+    uint32_t number;
+  };
+  std::unordered_map<uint32_t, SiteProfile> sites;
+  std::unordered_map<uint32_t, Biggest> biggest;
+  for (auto &[at, _] : p.sites)
+    sites[at].ip = at;
+  for (auto s = p.samples.begin(); s != p.samples.end();) {
+    auto [number, sample] = *s;
+    auto &counts = p.sites[sample.ip];
+    bool lives = alive(number);
+    if (sample.birth == p.collections) {
+      ++counts.collected;
+      counts.survived += lives;
+    }
+    if (!lives) {
+      s = p.samples.erase(s);
+      continue;
+    }
+    ++s;
+    auto &site = sites[sample.ip];
+    auto words = heap().at(number).end();
+    ++site.live;
+    site.live_words += sample.scale * double(words);
+    site.oldest = std::max(site.oldest, p.collections + 1 - sample.birth);
+    auto &big = biggest[sample.ip];
+    if (site.live == 1 || words > big.words ||
+        (words == big.words && sample.birth < big.birth))
+      big = {words, sample.birth, number};
+  }
+  ++p.collections;
+
+  // Breadth first from the roots clean() marked from, so each object's path
+  // back is one of its shortest. Only live objects are reached.
+  std::vector<Via> via(allocced.size() * 64);
+  std::vector<uint32_t> queue;
+  auto reach = [&](Alloc a, Via from) {
+    if (via[a.number].kind == Via::none) {
+      via[a.number] = from;
+      queue.push_back(a.number);
+    }
+  };
+  roots(reach);
+  for (size_t i = 0; i != queue.size(); ++i) {
+    for (auto w : *heap().at(queue[i]).data) {
+      if (w.alloc.is_alloc)
+        reach(w.alloc, {Via::object, queue[i]});
+    }
+  }
+
+  auto retention = [&](uint32_t number) {
+    std::vector<RetentionStep> path;
+    auto step = [&](std::string what) {
+      if (!path.empty() && path.back().what == what)
+        ++path.back().objects;
+      else
+        path.push_back({std::move(what), 1});
+    };
+    Via from{Via::object, number};
+    for (; from.kind == Via::object; from = via[from.index]) {
+      auto s = p.samples.find(from.index);
+      step(s == p.samples.end() ? "unsampled" : where(s->second.ip));
+    }
+    switch (from.kind) {
+    case Via::reg:
+      path.push_back({std::string(register_names.at(Register(from.index)))});
+      break;
+    case Via::stack:
+      path.push_back({fmt::format("stack {}", from.index)});
+      break;
+    case Via::data:
+      path.push_back({fmt::format("data {}", from.index)});
+      break;
+    default:
+      break;
+    }
+    std::ranges::reverse(path);
+    return path;
+  };
+
+  HeapProfile profile;
+  profile.collections = p.collections;
+  for (auto &[at, site] : sites) {
+    auto &counts = p.sites[at];
+    site.where = where(at);
+    site.sampled = counts.sampled;
+    site.survived = counts.survived;
+    site.collected = counts.collected;
+    if (site.live != 0)
+      site.path = retention(biggest[at].number);
+    profile.live_words += site.live_words;
+    profile.sites.push_back(std::move(site));
+  }
+  std::ranges::sort(profile.sites, [](auto &a, auto &b) {
+    if (a.live_words != b.live_words)
+      return a.live_words > b.live_words;
+    return a.ip < b.ip;
+  });
+  heapProfile = std::move(profile);
+}
+
+std::string tri::HeapProfile::dump() const {
+  auto out = fmt::format("heap profile after {} collections: ~{:.0f} live "
+                         "words\n",
+                         collections, live_words);
+  for (auto &site : sites) {
+    out += fmt::format("  {} (ip {}): ~{:.0f} live words, {} of {} samples "
+                       "live, {:.0f}% survived their first clean, oldest "
+                       "{}\n",
+                       site.where, site.ip, site.live_words, site.live,
+                       site.sampled, site.survival_rate() * 100, site.oldest);
+    if (site.path.empty())
+      continue;
+    out += "    kept by";
+    for (auto &step : site.path) {
+      out += step.objects == 0 ? fmt::format(" {}", step.what)
+                               : fmt::format(" > {} x{}", step.what,
+                                             step.objects);
+    }
+    out += "\n";
+  }
+  return out;
+}
@@ -0,0 +1,119 @@
+#include "tri/asm.hpp"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <stdexcept>
+#include <vector>
+
+using namespace tri;
+namespace {
+// "tril", a log of a tri VM's I/O
+constexpr uint32_t magic = 0x6c697274;
+
+void leb128(std::vector<std::byte> &out, uint64_t v) {
+  do {
+    auto low = std::byte(v & 0x7f);
+    v >>= 7;
+    out.push_back(v ? low | std::byte(0x80) : low);
+  } while (v);
+}
+
+class Reader {
+  std::span<const std::byte> in;
+
+public:
+  Reader(std::span<const std::byte> in) : in(in) {}
+  uint64_t leb128() {
+    uint64_t v = 0;
+    for (unsigned shift = 0; shift < 64; shift += 7) {
+      if (in.empty())
+        throw std::runtime_error("io log is truncated");
+      auto b = uint64_t(in.front());
+      in = in.subspan(1);
+      v |= (b & 0x7f) << shift;
+      if (!(b & 0x80))
+        return v;
+    }
+    throw std::runtime_error("io log has an overlong number");
+  }
+  bool empty() const noexcept { return in.empty(); }
+};
+} // namespace
+
+std::vector<std::byte> tri::IoLog::encode() const {
+  std::vector<std::byte> out;
+  leb128(out, magic);
+  leb128(out, log.size());
+  uint64_t last = 0;
+  for (auto &e : log) {
+    leb128(out, e.at - last);
+    leb128(out, uint64_t(e.port) << 1 | e.output);
+    leb128(out, e.value);
+    last = e.at;
+  }
+  return out;
+}
+
+tri::IoLog tri::IoLog::decode(std::span<const std::byte> bytes) {
+  Reader r(bytes);
+  if (r.leb128() != magic)
+    throw std::runtime_error("not an io log");
+  IoLog decoded;
+  // every event takes at least three bytes, so a corrupt count can't make
+  // us reserve much more than the log's own size
+  auto n = r.leb128();
+  decoded.log.reserve(std::min<uint64_t>(n, bytes.size() / 3));
+  uint64_t at = 0;
+  for (; n != 0; --n) {
+    IoEvent e;
+    e.at = at += r.leb128();
+    auto port = r.leb128();
+    e.port = uint32_t(port >> 1);
+    e.output = port & 1;
+    e.value = uint32_t(r.leb128());
+    decoded.log.push_back(e);
+  }
+  if (!r.empty())
+    throw std::runtime_error("io log has trailing bytes");
+  return decoded;
+}
+
+tri::ReplayReport tri::Interpreter::replay(const IoLog &log) {
+  auto events = log.events();
+  auto previous = ioLog;
+  IoLog seen;
+  record(&seen);
+  ReplayReport report;
+  // inputs go in in the order they were read, as many as fit at a time
+  size_t next = 0;
+  while (true) {
+    size_t fed = 0;
+    for (; next != events.size(); ++next) {
+      auto &e = events[next];
+      if (e.output)
+        continue;
+      if (!port(e.port).in.push(e.value))
+        break;
+      ++fed;
+    }
+    report.status = execute();
+    // what was written is checked against seen at the end
+    for (auto &p : ports)
+      p.out.consume(p.out.size());
+    if (report.status != Status::suspended)
+      break;
+    // wanting input the log doesn't have, or that can't be fed, means it
+    // has already gone another way
+    if (!suspension().output && fed == 0)
+      break;
+  }
+  ioLog = previous;
+
+  auto expected = log.events(), actual = seen.events();
+  auto [e, a] = std::ranges::mismatch(expected, actual);
+  report.matched = e - expected.begin();
+  report.diverged = e != expected.end() || a != actual.end();
+  return report;
+}
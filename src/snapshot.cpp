@@ -0,0 +1,225 @@
+#include "tri/asm.hpp"
+
+#include <algorithm>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+using namespace tri;
+namespace {
+// "tri" and a format version, with the top bit set for wide words so one
+// layout can't restore the other's snapshots
+constexpr uint32_t magic = 0x03697274 | uint32_t(sizeof(Word) == 8) << 31;
+
+// words are stored as their bits, whichever half of the union is active
+using P = WordPolicy;
+constexpr unsigned tag_bit = P::data_bits;
+constexpr uint64_t mask(unsigned bits) { return (uint64_t(1) << bits) - 1; }
+
+uint64_t bits(Word w) {
+  if (w.alloc.is_alloc)
+    return uint64_t(1) << tag_bit |
+           uint64_t(w.alloc.offset) << P::number_bits | w.alloc.number;
+  return w.val.data;
+}
+Word word(uint64_t bits) {
+  if (bits >> tag_bit & 1)
+    return Alloc(bits & mask(P::number_bits),
+                 bits >> P::number_bits & mask(P::offset_bits));
+  return Val(bits & mask(P::data_bits));
+}
+
+// little endian u32s all the way down
+class Writer {
+  std::vector<std::byte> &out;
+
+public:
+  Writer(std::vector<std::byte> &out) : out(out) {}
+  void u32(uint32_t v) {
+    for (int i = 0; i != 4; ++i)
+      out.push_back(std::byte(v >> i * 8));
+  }
+  void u64(uint64_t v) {
+    u32(uint32_t(v));
+    u32(uint32_t(v >> 32));
+  }
+  // a u32 or a u64, whichever the layout's words are
+  void word(Word w) {
+    if constexpr (sizeof(Word) == 8)
+      u64(bits(w));
+    else
+      u32(bits(w));
+  }
+  void words(std::span<const Word> ws) {
+    u32(ws.size());
+    for (auto w : ws)
+      word(w);
+  }
+  void string(std::string_view s) {
+    u32(s.size());
+    auto bytes = std::as_bytes(std::span(s));
+    out.insert(out.end(), bytes.begin(), bytes.end());
+  }
+};
+
+class Reader {
+  std::span<const std::byte> in;
+
+public:
+  Reader(std::span<const std::byte> in) : in(in) {}
+  std::span<const std::byte> take(size_t n) {
+    if (n > in.size())
+      throw std::runtime_error("snapshot is truncated");
+    auto taken = in.first(n);
+    in = in.subspan(n);
+    return taken;
+  }
+  uint32_t u32() {
+    auto b = take(4);
+    uint32_t v = 0;
+    for (int i = 0; i != 4; ++i)
+      v |= uint32_t(b[i]) << i * 8;
+    return v;
+  }
+  uint64_t u64() {
+    uint64_t low = u32();
+    return low | uint64_t(u32()) << 32;
+  }
+  // a count that is about to be read, checked against what is left so a
+  // corrupt one can't make us allocate gigabytes
+  uint32_t count(size_t bytesEach) {
+    auto n = u32();
+    if (size_t(n) * bytesEach > in.size())
+      throw std::runtime_error("snapshot is truncated");
+    return n;
+  }
+  Word word() {
+    if constexpr (sizeof(Word) == 8)
+      return ::word(u64());
+    else
+      return ::word(u32());
+  }
+  std::vector<Word> words() {
+    std::vector<Word> ws(count(sizeof(Word)));
+    for (auto &w : ws)
+      w = word();
+    return ws;
+  }
+  std::string string() {
+    auto b = take(count(1));
+    return {reinterpret_cast<const char *>(b.data()), b.size()};
+  }
+  bool empty() const noexcept { return in.empty(); }
+};
+} // namespace
+
+std::vector<std::byte> tri::Interpreter::snapshot() const {
+  std::vector<std::byte> out;
+  Writer w(out);
+  w.u32(magic);
+  for (auto r : registers)
+    w.word(r);
+  for (auto &v : vectors) {
+    for (auto lane : v)
+      w.u32(lane);
+  }
+  w.u32(handler.has_value());
+  w.u32(handler.value_or(0));
+  w.u32(handling.has_value());
+  w.word(Val(handling.value_or(0)));
+
+  w.u32(text->size());
+  for (auto i : *text)
+    w.u32(std::bit_cast<uint32_t>(i));
+  // data pages and the stack are one run of addresses
+  w.u32(dataWords + stack.size());
+  for (auto &page : data) {
+    for (auto word : *page)
+      w.word(word);
+  }
+  for (auto word : stack)
+    w.word(word);
+  w.u32(allocced.size());
+  for (auto &bits : allocced)
+    w.u64(bits.to_ullong());
+  w.u32(heap().size());
+  for (auto &[number, alloc] : heap()) {
+    w.u32(number);
+    w.words(*alloc.data);
+  }
+  w.u32(program.labels().size());
+  for (auto &[name, address] : program.labels()) {
+    w.string(name);
+    w.u32(address);
+  }
+  return out;
+}
+
+tri::Interpreter tri::Interpreter::restore(std::span<const std::byte> bytes) {
+  static_assert(sizeof(Instruction) == sizeof(uint32_t));
+  Reader r(bytes);
+  if (r.u32() != magic)
+    throw std::runtime_error("not a snapshot of this version");
+  Interpreter run;
+  for (auto &reg : run.registers)
+    reg = r.word();
+  // lanes are Vals, whatever the snapshot says
+  for (auto &v : run.vectors) {
+    for (auto &lane : v)
+      lane = r.u32() & ((1u << 31) - 1);
+  }
+  bool hasHandler = r.u32();
+  auto handler = r.u32();
+  if (hasHandler)
+    run.handler = handler;
+  bool isHandling = r.u32();
+  auto handling = r.word();
+  if (isHandling)
+    run.handling = handling.val;
+
+  Executable e;
+  e.text.assign(r.count(4), Instruction(InstructionType::noop));
+  for (auto &i : e.text)
+    i = std::bit_cast<Instruction>(r.u32());
+  // the whole stack is the VM's own, there's no data section to share
+  run.stack = r.words();
+  run.allocced.resize(r.count(8));
+  for (auto &bits : run.allocced)
+    bits = r.u64();
+  run.marks.assign(run.allocced.size(), 0);
+  for (auto n = r.count(8); n != 0; --n) {
+    auto number = r.u32();
+    if (number / 64 >= run.allocced.size() ||
+        !run.allocced[number / 64].test(number % 64))
+      throw std::runtime_error("snapshot has an unallocated heap object");
+    auto data = r.words();
+    Allocation alloc(run.arena.resource(), 0, false);
+    alloc.data->assign(data.begin(), data.end());
+    run.heapWords += data.size();
+    run.heap().insert({number, std::move(alloc)});
+  }
+  for (auto n = r.count(8); n != 0; --n) {
+    auto name = r.string();
+    e.labels.insert({std::move(name), r.u32()});
+  }
+  if (!r.empty())
+    throw std::runtime_error("snapshot has trailing bytes");
+  // clean() and every load assume a pointer's object exists
+  auto dangles = [&](Word w) {
+    return w.alloc.is_alloc && !run.heap().contains(w.alloc.number);
+  };
+  bool dangling = std::ranges::any_of(run.registers, dangles) ||
+                  std::ranges::any_of(run.stack, dangles);
+  for (auto &[_, alloc] : run.heap())
+    dangling = dangling || std::ranges::any_of(*alloc.data, dangles);
+  if (dangling)
+    throw std::runtime_error("snapshot has a pointer to no heap object");
+  // text is checked again rather than trusting the snapshot
+  run.load(Program(std::move(e)));
+  return run;
+}
@@ -0,0 +1,114 @@
+#include "tri/asm.hpp"
+
+#include <cstdint>
+#include <limits>
+
+using namespace tri;
+namespace {
+template <typename O> bool isReg(O o) { return o.reg.type == Type::reg; }
+
+template <typename O> bool readsIp(O o) {
+  return isReg(o) && o.reg.operand == Register::ip;
+}
+} // namespace
+
+// Called once the instruction at `at` has run, with ip where it went.
+tri::Interpreter::Trace *tri::Interpreter::onTrace(uint32_t at) {
+  uint32_t to = ip().val.data;
+  if (!recording.empty()) {
+    recording.back().taken = to != at + 1;
+    if (to == recording.front().at) {
+      compileTrace(recording);
+      auto &trace = traces[to] = std::move(recording);
+      recording.clear();
+      ++traceStats.recorded;
+      return &trace;
+    }
+    // hlt would leave the interpreter, so it can't be part of a loop
+    if (recording.size() == max_trace || to >= text->size() ||
+        (*text)[to].instruct == InstructionType::hlt) {
+      abortRecording();
+      return nullptr;
+    }
+    recordStep(to);
+    return nullptr;
+  }
+  if (auto t = traces.find(to); t != traces.end())
+    return &t->second;
+  recordStep(to);
+  return nullptr;
+}
+
+// notes the tags the instruction at `at` is about to see, and asks for an
+// event once it has run
+void tri::Interpreter::recordStep(uint32_t at) {
+  auto i = (*text)[at];
+  auto tag = [this](auto o) {
+    auto r = static_cast<size_t>(o.reg.operand);
+    return isReg(o) && r != 0 && r <= registers.size() &&
+           registers[r - 1].alloc.is_alloc;
+  };
+  TraceStep step{.at = at, .instruction = i};
+  switch (operandCount(i.instruct)) {
+  case opCount::three:
+    step.a_alloc = tag(i.op.ternary.a);
+    step.b_alloc = tag(i.op.ternary.b);
+    break;
+  case opCount::two:
+    step.a_alloc = tag(i.op.binary.a);
+    step.b_alloc = tag(i.op.binary.b);
+    break;
+  default:
+    break;
+  }
+  recording.push_back(step);
+  traceEvent = interrupted = true;
+}
+
+void tri::Interpreter::abortRecording() {
+  heat[recording.front().at] = std::numeric_limits<int16_t>::min();
+  recording.clear();
+  ++traceStats.aborted;
+}
+
+void tri::Interpreter::compileTrace(Trace &trace) {
+  for (auto &step : trace) {
+    auto i = step.instruction;
+    auto &t = i.op.ternary;
+    auto &b = i.op.binary;
+    // ip is only kept up to date for generic steps
+    switch (i.instruct) {
+    case InstructionType::addi:
+    case InstructionType::subi: {
+      if (readsIp(t.a) || readsIp(t.b) || t.out == Register::ip ||
+          step.b_alloc)
+        break;
+      auto add = i.instruct == InstructionType::addi;
+      if (!step.a_alloc)
+        step.kind = add ? TraceStep::add_vals : TraceStep::sub_vals;
+      else
+        step.kind = add ? TraceStep::add_ptr : TraceStep::sub_ptr;
+      break;
+    }
+    case InstructionType::mov:
+      if (!readsIp(b.a) && !(isReg(b.b) && b.b.reg.operand == Register::ip))
+        step.kind = TraceStep::mov;
+      break;
+    case InstructionType::jnz:
+    case InstructionType::jez:
+      if (!readsIp(b.a) && !isReg(b.b))
+        step.kind = TraceStep::branch;
+      break;
+    case InstructionType::jmp:
+      if (!isReg(i.op.unary))
+        step.kind = TraceStep::jump;
+      break;
+    case InstructionType::call:
+      if (!isReg(i.op.unary))
+        step.kind = TraceStep::call;
+      break;
+    default:
+      break;
+    }
+  }
+}
@@ -0,0 +1,129 @@
+#include "tri/asm.hpp"
+
+#include <cstddef>
+#include <span>
+
+using namespace tri;
+
+namespace {
+
+bool valid(Register r) { return r != Register::invalid && !isVector(r); }
+
+bool lane(Register r) {
+  return isVector(r) && static_cast<size_t>(r) < register_count;
+}
+
+// jumping is the only way ip gets written
+bool writable(Register r) { return valid(r) && r != Register::ip; }
+
+template <typename O> bool isRegister(O o) {
+  return o.reg.type == Type::reg && valid(o.reg.operand);
+}
+
+template <typename O> bool isLane(O o) {
+  return o.reg.type == Type::reg && lane(o.reg.operand);
+}
+
+template <typename O> bool isWritable(O o) {
+  return o.reg.type == Type::reg && writable(o.reg.operand);
+}
+
+// either a literal or a register that exists
+template <typename O> bool readable(O o) {
+  return o.lit.type == Type::lit || valid(o.reg.operand);
+}
+
+template <typename O> bool target(O o, size_t size) {
+  if (o.lit.type == Type::lit)
+    return uint32_t(o.lit) < size;
+  return valid(o.reg.operand);
+}
+
+bool verifyInstruction(const Instruction &i, size_t size) {
+  if (static_cast<size_t>(i.instruct) >= instruction_count)
+    return false;
+  auto &op = i.op;
+  switch (i.instruct) {
+  case InstructionType::addi:
+  case InstructionType::subi:
+  case InstructionType::muli:
+  case InstructionType::divi:
+  case InstructionType::mcmp:
+  case InstructionType::realloc:
+    return readable(op.ternary.a) && readable(op.ternary.b) &&
+           writable(op.ternary.out);
+  case InstructionType::mcpy:
+  case InstructionType::mset:
+    return readable(op.ternary.a) && readable(op.ternary.b) &&
+           valid(op.ternary.out);
+  case InstructionType::vadd:
+  case InstructionType::vsub:
+  case InstructionType::vmul:
+  case InstructionType::vmin:
+  case InstructionType::vmax:
+  case InstructionType::vcmp:
+    return isLane(op.ternary.a) && isLane(op.ternary.b) &&
+           lane(op.ternary.out);
+  case InstructionType::vld:
+  case InstructionType::vset:
+    return readable(op.binary.a) && isLane(op.binary.b);
+  case InstructionType::vst:
+    return isLane(op.binary.a) && readable(op.binary.b);
+  case InstructionType::vsum:
+  case InstructionType::vhmin:
+  case InstructionType::vhmax:
+    return isLane(op.binary.a) && isWritable(op.binary.b);
+  case InstructionType::mov:
+  case InstructionType::load:
+  case InstructionType::alloc:
+    return readable(op.binary.a) && isWritable(op.binary.b);
+  case InstructionType::store:
+    return readable(op.binary.a) && isRegister(op.binary.b);
+  case InstructionType::ldc:
+    return isWritable(op.binary.a) && readable(op.binary.b);
+  case InstructionType::recv:
+    return readable(op.binary.a) && isWritable(op.binary.b);
+  case InstructionType::send:
+    return readable(op.binary.a) && readable(op.binary.b);
+  case InstructionType::jnz:
+  case InstructionType::jez:
+    return readable(op.binary.a) && target(op.binary.b, size);
+  case InstructionType::out:
+    return isRegister(op.unary);
+  case InstructionType::in:
+    return isWritable(op.unary);
+  case InstructionType::jmp:
+  case InstructionType::call:
+    return target(op.unary, size);
+  case InstructionType::push:
+  case InstructionType::enter:
+    return readable(op.unary);
+  case InstructionType::pop:
+    return isWritable(op.unary);
+  case InstructionType::hlt:
+  case InstructionType::noop:
+  case InstructionType::leave:
+  case InstructionType::ret:
+    return true;
+  }
+  return false;
+}
+
+} // namespace
+
+namespace tri::inline TRI_LAYOUT {
+bool verify(std::span<const Instruction> text) noexcept {
+  if (text.empty())
+    return false;
+  // falling off the end is only possible after something other than these
+  auto last = text.back().instruct;
+  if (last != InstructionType::hlt && last != InstructionType::jmp &&
+      last != InstructionType::ret)
+    return false;
+  for (auto &i : text) {
+    if (!verifyInstruction(i, text.size()))
+      return false;
+  }
+  return true;
+}
+} // namespace tri::inline TRI_LAYOUT
@@ -1,7 +1,6 @@
 #include "fmt/format.h"
 #include "tri/asm.hpp"
-#include <iostream>
-#include <sstream>
+#include <string_view>
 #include <utility>
 
 int main() {
@@ -26,17 +25,12 @@ int main() {
                      "jnz r4 @output";
   auto e = tri::assemble(data, read_string);
   auto run = tri::Interpreter(std::move(e));
-  std::string input = "hello world!\n";
-  auto n = std::stringstream(input);
-  bool length_given = false;
-  run.in = [&]() -> uint32_t {
-    if (length_given)
-      return n.get();
-    else {
-      length_given = true;
-      return 13;
-    }
-  };
+  std::string_view input = "hello world!\n";
+  auto &port = run.port();
+  port.in.push(input.size());
+  for (auto c : input)
+    port.in.push(c);
   run.execute();
+  fmt::print("{}", port.out.read_text());
   fmt::print("words: {}\n", run.mem_consumption());
 }
\ No newline at end of file
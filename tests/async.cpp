@@ -0,0 +1,179 @@
+#include "fmt/format.h"
+#include "tri/async.hpp"
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <coroutine>
+#include <fcntl.h>
+#include <string>
+#include <string_view>
+#include <sys/epoll.h>
+#include <unistd.h>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// shifts every byte up by one until it reads a 0
+constexpr auto text = "@loop\n"
+                      "in r0\n"
+                      "jez r0 @done\n"
+                      "addi r0 1 r0\n"
+                      "out r0\n"
+                      "jmp @loop\n"
+                      "@done\n";
+
+// a single threaded event loop, coroutines wait on a file descriptor and get
+// resumed when epoll reports it ready
+class Loop {
+  int epoll = epoll_create1(0);
+  std::unordered_map<int, std::coroutine_handle<>> waiting;
+
+public:
+  ~Loop() { close(epoll); }
+
+  auto ready(int fd, uint32_t events) {
+    struct Ready {
+      Loop &loop;
+      int fd;
+      uint32_t events;
+      bool await_ready() const noexcept { return false; }
+      void await_suspend(std::coroutine_handle<> h) {
+        loop.waiting[fd] = h;
+        epoll_event e{.events = events, .data = {.fd = fd}};
+        epoll_ctl(loop.epoll, EPOLL_CTL_ADD, fd, &e);
+      }
+      void await_resume() const noexcept {}
+    };
+    return Ready{*this, fd, events};
+  }
+
+  void run() {
+    std::array<epoll_event, 16> events;
+    while (!waiting.empty()) {
+      auto n = epoll_wait(epoll, events.data(), events.size(), -1);
+      for (int i = 0; i < n; ++i) {
+        auto fd = events[i].data.fd;
+        epoll_ctl(epoll, EPOLL_CTL_DEL, fd, nullptr);
+        auto h = waiting.at(fd);
+        waiting.erase(fd);
+        h.resume();
+      }
+    }
+  }
+};
+
+struct Pipes {
+  // host -> guest and guest -> host, [0] is the read end
+  int in[2], out[2];
+  Pipes() {
+    pipe2(in, O_NONBLOCK);
+    pipe2(out, O_NONBLOCK);
+  }
+};
+
+// fills or drains the channel the guest is waiting on from its pipe
+tri::Task<> pump(Loop &loop, Pipes &pipes, tri::Interpreter &run,
+                 tri::Suspension s) {
+  auto &port = run.port(s.port);
+  std::array<char, 256> bytes;
+  if (s.output) {
+    // the guest stays suspended until the pipe took everything, which is
+    // how a slow reader slows it down
+    while (!port.out.empty()) {
+      auto words = port.out.peek();
+      auto n = std::min(words.size(), bytes.size());
+      std::copy_n(words.begin(), n, bytes.begin());
+      auto written = write(pipes.out[1], bytes.data(), n);
+      if (written > 0)
+        port.out.consume(written);
+      else if (errno == EAGAIN)
+        co_await loop.ready(pipes.out[1], EPOLLOUT);
+      else
+        co_return;
+    }
+    co_return;
+  }
+  while (true) {
+    auto space = port.in.reserve();
+    auto n = read(pipes.in[0], bytes.data(),
+                  std::min(space.size(), bytes.size()));
+    if (n > 0) {
+      std::copy_n(bytes.begin(), n, space.begin());
+      port.in.commit(n);
+      co_return;
+    }
+    if (n == 0 || errno != EAGAIN) {
+      // the guest takes a 0 as the end of its input
+      port.in.push(0);
+      co_return;
+    }
+    co_await loop.ready(pipes.in[0], EPOLLIN);
+  }
+}
+
+tri::Task<> guest(Loop &loop, Pipes &pipes, tri::Interpreter &run,
+                  tri::Status &status) {
+  status = co_await tri::run_async(
+      run, [&](tri::Interpreter &, tri::Suspension s) {
+        return pump(loop, pipes, run, s);
+      });
+  co_await pump(loop, pipes, run, {0, true});
+  close(pipes.out[1]);
+}
+
+// writes a message a few bytes at a time so the guests keep suspending
+tri::Task<> feed(Loop &loop, int fd, std::string message) {
+  for (std::string_view rest = message; !rest.empty();) {
+    co_await loop.ready(fd, EPOLLOUT);
+    auto written = write(fd, rest.data(), std::min<size_t>(rest.size(), 7));
+    if (written > 0)
+      rest.remove_prefix(written);
+  }
+  close(fd);
+}
+
+tri::Task<> collect(Loop &loop, int fd, std::string &result) {
+  std::array<char, 256> bytes;
+  while (true) {
+    auto n = read(fd, bytes.data(), bytes.size());
+    if (n > 0)
+      result.append(bytes.data(), n);
+    else if (n < 0 && errno == EAGAIN)
+      co_await loop.ready(fd, EPOLLIN);
+    else
+      break;
+  }
+  close(fd);
+}
+
+int main() {
+  constexpr size_t count = 4;
+  Loop loop;
+  std::vector<Pipes> pipes(count);
+  std::vector<tri::Interpreter> runs;
+  // the tasks hold on to these, so they must not move
+  runs.reserve(count);
+  std::vector<tri::Status> status(count);
+  std::vector<std::string> results(count);
+  std::vector<tri::Task<>> tasks;
+  for (size_t i = 0; i != count; ++i) {
+    runs.emplace_back(tri::assemble("", text));
+    auto message = fmt::format("HAL {} says hello, ", i);
+    // long enough that the guest's output channel fills up too
+    for (int n = 0; n != 5; ++n)
+      message += message;
+    tasks.push_back(guest(loop, pipes[i], runs.back(), status[i]));
+    tasks.push_back(feed(loop, pipes[i].in[1], std::move(message)));
+    tasks.push_back(collect(loop, pipes[i].out[0], results[i]));
+  }
+  for (auto &task : tasks)
+    task.resume();
+  loop.run();
+
+  for (size_t i = 0; i != count; ++i) {
+    fmt::print("vm {}: status: {} bytes: {} starts with: {:?}\n", i,
+               int(status[i]), results[i].size(), results[i].substr(0, 22));
+  }
+  bool done = std::ranges::all_of(tasks, [](auto &t) { return t.done(); });
+  fmt::print("all done: {}\n", done);
+}
@@ -0,0 +1,262 @@
+#include "fmt/format.h"
+#include "tri/asm.hpp"
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <utility>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+// Hardware counters for this thread, from perf_event_open. Counters that
+// can't be opened, in a container or on a host without a PMU say, read as
+// empty and everything else still works.
+class Counters {
+public:
+  enum Event { cycles, instructions, branch_misses, l1_misses, llc_misses };
+  static constexpr size_t count = 5;
+  using Sample = std::array<std::optional<uint64_t>, count>;
+
+  Counters() {
+    fds.fill(-1);
+#ifdef __linux__
+    constexpr uint64_t l1Reads = PERF_COUNT_HW_CACHE_L1D |
+                                 PERF_COUNT_HW_CACHE_OP_READ << 8 |
+                                 PERF_COUNT_HW_CACHE_RESULT_MISS << 16;
+    constexpr std::pair<uint32_t, uint64_t> events[count] = {
+        {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+        {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+        {PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+        {PERF_TYPE_HW_CACHE, l1Reads},
+        {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES},
+    };
+    for (size_t i = 0; i != count; ++i) {
+      perf_event_attr attr{};
+      attr.size = sizeof attr;
+      attr.type = events[i].first;
+      attr.config = events[i].second;
+      attr.disabled = 1;
+      // only what this process does, which is all an unprivileged one may
+      // count anyway
+      attr.exclude_kernel = 1;
+      attr.exclude_hv = 1;
+      fds[i] = int(syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0));
+    }
+#endif
+  }
+  ~Counters() {
+#ifdef __linux__
+    for (auto fd : fds) {
+      if (fd >= 0)
+        close(fd);
+    }
+#endif
+  }
+  Counters(const Counters &) = delete;
+  Counters &operator=(const Counters &) = delete;
+
+  bool available() const noexcept {
+    return std::ranges::any_of(fds, [](int fd) { return fd >= 0; });
+  }
+  void start() {
+#ifdef __linux__
+    for (auto fd : fds) {
+      if (fd >= 0) {
+        ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+        ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+      }
+    }
+#endif
+  }
+  Sample stop() {
+    Sample sample;
+#ifdef __linux__
+    for (size_t i = 0; i != count; ++i) {
+      uint64_t value;
+      if (fds[i] < 0)
+        continue;
+      ioctl(fds[i], PERF_EVENT_IOC_DISABLE, 0);
+      if (read(fds[i], &value, sizeof value) == sizeof value)
+        sample[i] = value;
+    }
+#endif
+    return sample;
+  }
+
+private:
+  std::array<int, count> fds;
+};
+
+// a guest loop to time
+struct Workload {
+  const char *name;
+  const char *text;
+};
+
+// val + val with register and literal operands
+constexpr auto vals = "mov 0x100000 r5\n"
+                      "@loop\n"
+                      "addi r1 1 r1\n"
+                      "addi r2 r1 r2\n"
+                      "subi r2 3 r2\n"
+                      "addi r3 r1 r3\n"
+                      "subi r3 r2 r3\n"
+                      "addi r4 5 r4\n"
+                      "subi r4 1 r4\n"
+                      "subi r5 1 r5\n"
+                      "jnz r5 @loop\n"
+                      "hlt\n";
+
+// pointer arithmetic, alloc + val, val + alloc, alloc - val and
+// alloc - alloc
+constexpr auto pointers = "alloc 8 r1\n"
+                          "mov 0x100000 r5\n"
+                          "@loop\n"
+                          "addi r1 3 r2\n"
+                          "addi 2 r2 r3\n"
+                          "subi r3 4 r2\n"
+                          "subi r3 r1 r4\n"
+                          "addi r2 r4 r3\n"
+                          "subi r3 r2 r4\n"
+                          "addi r4 r1 r2\n"
+                          "subi r5 1 r5\n"
+                          "jnz r5 @loop\n"
+                          "hlt\n";
+
+// a linked list, one four word object per node
+constexpr uint64_t nodes = 1 << 16;
+constexpr auto list = "mov 0 r2\n"
+                      "mov 0x10000 r5\n"
+                      "@loop\n"
+                      "alloc 4 r1\n"
+                      "store r2 r1\n"
+                      "mov r1 r2\n"
+                      "subi r5 1 r5\n"
+                      "jnz r5 @loop\n"
+                      "hlt\n";
+
+// loads, bumps and stores back every word of a 4096 word object, 256 times
+constexpr auto memory = "alloc 0x1000 r1\n"
+                        "mov 0x100 r6\n"
+                        "@outer\n"
+                        "mov 0x1000 r5\n"
+                        "mov r1 r3\n"
+                        "@inner\n"
+                        "load r3 r2\n"
+                        "addi r2 1 r2\n"
+                        "store r2 r3\n"
+                        "addi r3 1 r3\n"
+                        "subi r5 1 r5\n"
+                        "jnz r5 @inner\n"
+                        "subi r6 1 r6\n"
+                        "jnz r6 @outer\n"
+                        "hlt\n";
+
+constexpr Workload workloads[] = {
+    {"addi/subi vals", vals},
+    {"addi/subi pointers", pointers},
+    {"linked list", list},
+    {"load/store", memory},
+};
+
+// a counter per guest instruction or access, n/a if it couldn't be read
+std::string per(std::optional<uint64_t> counter, uint64_t events) {
+  if (!counter || events == 0)
+    return "n/a";
+  return fmt::format("{:.3f}", double(*counter) / double(events));
+}
+
+// one run of a workload, the counters are empty if they couldn't be read
+struct Measurement {
+  double ns_per_instruction;
+  // guest instructions the interpreter retired
+  uint64_t instructions;
+  Counters::Sample counters;
+  // loads and stores that went to the heap
+  uint64_t accesses;
+};
+
+Measurement measure(Counters &counters, const Workload &w, bool tracing) {
+  auto run = tri::Interpreter(tri::assemble("", w.text));
+  run.enable_tracing(tracing);
+  auto begin = std::chrono::steady_clock::now();
+  counters.start();
+  run.execute();
+  auto sample = counters.stop();
+  auto elapsed = std::chrono::steady_clock::now() - begin;
+  auto &heap = run.heap_cache_stats();
+  auto retired = run.retired_instructions();
+  return {std::chrono::duration<double, std::nano>(elapsed).count() /
+              double(retired),
+          retired, sample, heap.hits + heap.misses};
+}
+
+void report(const char *tier, const Measurement &m) {
+  auto &c = m.counters;
+  fmt::print("  {}: {} host instructions, {} cycles and {} branch misses per "
+             "guest instruction, {} L1 and {} LLC misses per heap "
+             "load/store\n",
+             tier, per(c[Counters::instructions], m.instructions),
+             per(c[Counters::cycles], m.instructions),
+             per(c[Counters::branch_misses], m.instructions),
+             per(c[Counters::l1_misses], m.accesses),
+             per(c[Counters::llc_misses], m.accesses));
+}
+
+// bytes of guest heap the list ends up holding, not counting the host's
+// bookkeeping for each object
+size_t footprint() {
+  auto run = tri::Interpreter(tri::assemble("", list));
+  run.execute();
+  return run.mem_consumption() * sizeof(tri::Word);
+}
+
+// clean() with the whole list reachable, then again once the guest has
+// dropped it
+void cleanCounters(Counters &counters) {
+  auto text = std::string(list) + "mov 0 r1\nmov 0 r2\nhlt\n";
+  auto run = tri::Interpreter(tri::assemble("", text.c_str()));
+  for (auto state : {"live", "dead"}) {
+    run.execute();
+    auto begin = std::chrono::steady_clock::now();
+    counters.start();
+    run.clean();
+    auto sample = counters.stop();
+    auto elapsed = std::chrono::steady_clock::now() - begin;
+    fmt::print("clean() of {} {} objects: {:.2f} ms", nodes, state,
+               std::chrono::duration<double, std::milli>(elapsed).count());
+    if (counters.available())
+      fmt::print(", {} cycles, {} L1 and {} LLC misses per object",
+                 per(sample[Counters::cycles], nodes),
+                 per(sample[Counters::l1_misses], nodes),
+                 per(sample[Counters::llc_misses], nodes));
+    fmt::print("\n");
+  }
+}
+
+int main() {
+  Counters counters;
+  fmt::print("layout: {} bit words, hardware counters: {}\n",
+             sizeof(tri::Word) * 8,
+             counters.available() ? "available" : "unavailable");
+  for (auto &w : workloads) {
+    auto interpreted = measure(counters, w, false);
+    auto traced = measure(counters, w, true);
+    fmt::print("{}: {:.2f} ns per instruction, {:.2f} traced\n", w.name,
+               interpreted.ns_per_instruction, traced.ns_per_instruction);
+    if (counters.available()) {
+      report("interpreted", interpreted);
+      report("traced", traced);
+    }
+  }
+  cleanCounters(counters);
+  fmt::print("linked list of {} nodes: {} KiB of heap words\n", nodes,
+             footprint() / 1024);
+}
@@ -6,6 +6,7 @@
 #include <stdexcept>
 #include <utility>
 #include <vector>
+
 /*
 this is the btree that will be formed
    l  l  !  \n
@@ -109,18 +110,15 @@ int main() {
   std::vector<int> sequence = {'h',  true,  'e',   true,  'l',  false, false,
                                true, 'l',   false, false, true, 'o',   true,
                                '!',  false, false, true,  '\n', false, false};
-  std::ranges::reverse(sequence);
-  run.in = [&]() {
-    if (sequence.empty())
-      throw std::runtime_error("sequence overquery");
-    auto val = sequence.back();
-    sequence.pop_back();
-    return val;
-  };
+  std::vector<uint32_t> input(sequence.begin(), sequence.end());
+  auto &port = run.port();
+  port.in.write(input);
   // run.enable_debug();
   run.execute();
+  fmt::print("{}", port.out.read_text());
   fmt::print("words: {}\n", run.mem_consumption());
   run.execute();
+  fmt::print("{}", port.out.read_text());
   run.clean();
   fmt::print("words: {}\n", run.mem_consumption());
 }
\ No newline at end of file
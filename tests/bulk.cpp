@@ -0,0 +1,55 @@
+#include "fmt/format.h"
+#include "tri/asm.hpp"
+#include <utility>
+
+constexpr auto data = ".ascii msg 'hello bulk!\\n'\n"
+                      ".int len 12";
+constexpr auto text = "mov len r3\n"
+                      "alloc len r1\n"
+                      "mcpy msg r1 r3\n" // stack -> heap
+                      "mcmp msg r1 r3\n" // 0, they're equal
+                      "out r3\n"
+                      "mov 0x2a r4\n"
+                      "mov 6 r3\n"
+                      "addi r1 6 r2\n"
+                      "mset r2 r4 r3\n" // second half becomes '*'
+                      "mov len r3\n"
+                      "mcmp msg r1 r3\n" // 7, the first difference + 1
+                      "out r3\n"
+                      "mov len r3\n"
+                      "mcpy r1 0 r3\n" // heap -> stack, over msg
+                      "@print\n"
+                      "load r5 r6\n"
+                      "out r6\n"
+                      "addi r5 1 r5\n"
+                      "subi r5 len r6\n"
+                      "jnz r6 @print\n"
+                      // a copied pointer keeps what it points at alive
+                      "alloc 2 r5\n"
+                      "alloc 1 r6\n"
+                      "store r6 r5\n"
+                      "alloc 2 r7\n"
+                      "mov 2 r3\n"
+                      "mcpy r5 r7 r3\n"
+                      "mov 0 r5\n"
+                      "mov 0 r6\n"
+                      "hlt\n"
+                      "mov 13 r3\n"
+                      "mcpy r1 0 r3\n"; // one word past the end traps
+
+int main() {
+  auto run = tri::Interpreter(tri::assemble(data, text));
+  run.execute();
+  auto &out = run.port().out;
+  uint32_t equal, differ;
+  out.pop(equal);
+  out.pop(differ);
+  fmt::print("equal: {} differ: {}\n", equal, differ);
+  for (uint32_t c; out.pop(c);)
+    fmt::print("{}", char(c));
+  fmt::print("\n");
+  run.clean();
+  fmt::print("memory: {}\n", run.mem_consumption());
+  auto status = run.execute();
+  fmt::print("status: {} code: {}\n", int(status), int(run.trap().code));
+}
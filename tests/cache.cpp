@@ -0,0 +1,49 @@
+#include "fmt/format.h"
+#include "tri/asm.hpp"
+
+// fills 16 words with their index and sums them, so the store and load run
+// on the same object over and over
+constexpr auto text = "@start\n"
+                      "alloc 16 r1\n"
+                      "mov 16 r2\n"
+                      "@fill\n"
+                      "subi r2 1 r2\n"
+                      "addi r1 r2 r3\n"
+                      "store r2 r3\n"
+                      "jnz r2 @fill\n"
+                      "mov 16 r2\n"
+                      "mov 0 r4\n"
+                      "@sum\n"
+                      "subi r2 1 r2\n"
+                      "addi r1 r2 r3\n"
+                      "load r3 r5\n"
+                      "addi r4 r5 r4\n"
+                      "jnz r2 @sum\n"
+                      "out r4\n"
+                      "mov 0 r1\n"
+                      "mov 0 r3\n"
+                      "hlt\n"
+                      "jmp @start\n";
+
+void report(tri::Interpreter &run) {
+  uint32_t sum = 0;
+  run.port().out.pop(sum);
+  auto &stats = run.heap_cache_stats();
+  fmt::print("sum: {} hits: {} misses: {} hit rate: {:.3}\n", sum, stats.hits,
+             stats.misses, stats.hit_rate());
+}
+
+int main() {
+  auto run = tri::Interpreter(tri::assemble("", text));
+  run.execute();
+  report(run);
+  // frees the object, the next one gets the same number and has to be
+  // looked up again
+  run.clean();
+  run.execute();
+  report(run);
+  // copies don't share their sites
+  auto copy = run.fork();
+  copy.execute();
+  report(copy);
+}
@@ -0,0 +1,72 @@
+#include "fmt/format.h"
+#include "tri/asm.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <numeric>
+#include <utility>
+#include <vector>
+
+// copies port 1 to port 2 until a 0, then sends the sum of what it copied
+constexpr auto text = "@loop\n"
+                      "recv 1 r0\n"
+                      "jez r0 @done\n"
+                      "addi r1 r0 r1\n"
+                      "send r0 2\n"
+                      "jmp @loop\n"
+                      "@done\n"
+                      "send r1 2\n";
+
+int main() {
+  std::vector<uint32_t> input(1 << 20);
+  std::iota(input.begin(), input.end() - 1, 1);
+  input.back() = 0;
+
+  auto run = tri::Interpreter(tri::assemble("", text));
+  auto &in = run.port(1).in;
+  auto &out = run.port(2).out;
+  size_t fed = 0, received = 0, suspended = 0;
+  uint32_t sum = 0, last = 0;
+  // the guest adds in 31 bits, or 63 cut to 32 on the way out with wide words
+  constexpr uint32_t mask = sizeof(tri::Word) == 8 ? ~0u : (1u << 31) - 1;
+  auto begin = std::chrono::steady_clock::now();
+  while (true) {
+    // the guest suspends once in is empty or out is full, both are handled
+    // a span at a time without copying through an intermediate buffer
+    auto space = in.reserve();
+    auto n = std::min(space.size(), input.size() - fed);
+    std::copy_n(input.begin() + fed, n, space.begin());
+    in.commit(n);
+    fed += n;
+    auto status = run.execute();
+    for (auto words = out.peek(); !words.empty(); words = out.peek()) {
+      for (auto w : words)
+        sum = (sum + w) & mask;
+      received += words.size();
+      last = words.back();
+      out.consume(words.size());
+    }
+    if (status != tri::Status::suspended)
+      break;
+    ++suspended;
+  }
+  auto elapsed = std::chrono::steady_clock::now() - begin;
+
+  // the guest's sum is the last word, everything before it adds up to it
+  sum = (sum - last) & mask;
+  fmt::print("received: {} suspended: {} sum matches: {}\n", received,
+             suspended, sum == last);
+  fmt::print(
+      "{:.2f} ns per word\n",
+      std::chrono::duration<double, std::nano>(elapsed).count() / received);
+
+  // a literal destination traps, and the word is still there for a retry
+  for (auto [name, bad] :
+       {std::pair{"in", "in 5\n"}, std::pair{"recv", "recv 0 5\n"}}) {
+    auto trapped = tri::Interpreter(tri::assemble("", bad));
+    trapped.port().in.push(42);
+    auto status = trapped.execute();
+    fmt::print("{}: status: {} code: {} words left: {}\n", name, int(status),
+               int(trapped.trap().code), trapped.port().in.size());
+  }
+}
@@ -0,0 +1,63 @@
+#include "fmt/format.h"
+#include "tri/asm.hpp"
+#include <utility>
+
+constexpr auto text = "mov 10 r0\n"
+                      "call @sum\n"
+                      "out r0\n"
+                      "push 1\n"
+                      "push 2\n"
+                      "pop r2\n"
+                      "pop r3\n"
+                      "out r2\n"
+                      "out r3\n"
+                      "call @leak\n"
+                      "call @hold\n"
+                      "hlt\n"
+                      "@sum\n" // r0 = n, returns n + (n - 1) + ... + 0
+                      "enter 1\n"
+                      "addi bp 1 r1\n"
+                      "store r0 r1\n" // local = n
+                      "jez r0 @base\n"
+                      "subi r0 1 r0\n"
+                      "call @sum\n"
+                      "addi bp 1 r1\n"
+                      "load r1 r1\n"
+                      "addi r0 r1 r0\n"
+                      "@base\n"
+                      "leave\n"
+                      "ret\n"
+                      "@leak\n" // leaves a pointer behind in its local
+                      "enter 1\n"
+                      "alloc 5 r1\n"
+                      "addi bp 1 r2\n"
+                      "store r1 r2\n"
+                      "mov 0 r1\n"
+                      "leave\n"
+                      "ret\n"
+                      "@hold\n" // reuses that slot and stops inside
+                      "enter 1\n"
+                      "hlt\n"
+                      "leave\n"
+                      "ret\n";
+
+int main() {
+  auto e = tri::assemble("", text);
+  auto run = tri::Interpreter(std::move(e));
+  run.execute();
+  auto &out = run.port().out;
+  for (uint32_t w; out.pop(w);)
+    fmt::print("{} ", w);
+  // the only pointer to the allocation was in a local that enter cleared
+  run.clean();
+  fmt::print("\nmemory inside hold: {}\n", run.mem_consumption());
+  fmt::print("status: {}\n", int(run.execute()));
+
+  // the stack grows once for the whole frame, so a huge one traps on the
+  // budget before any local is written
+  auto huge = tri::Interpreter(tri::assemble("", "enter 0x40000000\nhlt\n"));
+  huge.set_limits({.stack_words = 0x1000});
+  auto status = huge.execute();
+  fmt::print("huge frame: status: {} code: {}\n", int(status),
+             int(huge.trap().code));
+}
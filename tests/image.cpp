@@ -0,0 +1,57 @@
+#include "fmt/format.h"
+#include "tri/asm.hpp"
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// writes its input value to the data word at its input index, then outputs
+// the sum of the whole data section. Each run after the first starts over.
+constexpr auto text = "@start\n"
+                      "in r1\n"
+                      "in r2\n"
+                      "store r2 r1\n"
+                      "mov 0 r3\n"
+                      "mov 0 r4\n"
+                      "@sum\n"
+                      "load r3 r5\n"
+                      "addi r4 r5 r4\n"
+                      "addi r3 1 r3\n"
+                      "subi r3 2048 r6\n"
+                      "jnz r6 @sum\n"
+                      "out r4\n"
+                      "hlt\n"
+                      "jmp @start\n";
+
+uint32_t run(tri::Interpreter &vm, uint32_t index, uint32_t value) {
+  vm.port().in.push(index);
+  vm.port().in.push(value);
+  vm.execute();
+  uint32_t sum = 0;
+  vm.port().out.pop(sum);
+  return sum;
+}
+
+int main() {
+  auto data = ".ascii text '" + std::string(2048, 'a') + "'";
+  auto program = tri::Program(tri::assemble(data.c_str(), text));
+  fmt::print("program: {} data words, {} instructions, verified: {}\n",
+             program.data_words(), program.text().size(),
+             program.verified());
+
+  // every vm shares the text and data, and copies the one page it writes
+  std::vector<tri::Interpreter> vms;
+  for (int i = 0; i != 1000; ++i)
+    vms.emplace_back(program);
+  bool correct = true;
+  for (uint32_t i = 0; i != vms.size(); ++i)
+    correct &= run(vms[i], i * 2, i) == 'a' * 2047 + i;
+  fmt::print("vms: {} correct: {}\n", vms.size(), correct);
+
+  // none of that reached the program
+  auto fresh = tri::Interpreter(program);
+  fmt::print("fresh: {}\n", run(fresh, 0, 'a'));
+
+  // vm 5 wrote 5 to word 10, which its snapshot keeps
+  auto restored = tri::Interpreter::restore(vms[5].snapshot());
+  fmt::print("restored: {}\n", run(restored, 11, 'a'));
+}
@@ -0,0 +1,60 @@
+#include "fmt/format.h"
+#include "tri/asm.hpp"
+
+constexpr auto data = ".ascii up 'abcdefgh'\n"
+                      ".ascii down 'hgfedcba'";
+constexpr auto text = "vld up v0\n"
+                      "vld down v1\n"
+                      "vadd v0 v1 v2\n"
+                      "vsum v2 r0\n" // 8 * ('a' + 'h')
+                      "out r0\n"
+                      "vcmp v0 v1 v3\n"
+                      "vsum v3 r0\n" // no lane is equal
+                      "out r0\n"
+                      "vset 2 v4\n"
+                      "vmul v0 v4 v5\n"
+                      "vhmin v5 r0\n" // 2 * 'a'
+                      "out r0\n"
+                      "vmax v0 v1 v6\n"
+                      "vhmin v6 r0\n" // 'e'
+                      "out r0\n"
+                      "vmin v0 v1 v7\n"
+                      "alloc 8 r1\n"
+                      "vst v7 r1\n"
+                      "mov 0 r2\n"
+                      "@print\n"
+                      "load r1 r3\n"
+                      "out r3\n"
+                      "addi r1 1 r1\n"
+                      "addi r2 1 r2\n"
+                      "subi r2 8 r3\n"
+                      "jnz r3 @print\n"
+                      "hlt\n"
+                      // lanes never hold pointers
+                      "alloc 8 r2\n"
+                      "store r2 r2\n"
+                      "vld r2 v0\n";
+
+void print(tri::Executable exe) {
+  auto run = tri::Interpreter(std::move(exe));
+  run.execute();
+  auto &out = run.port().out;
+  uint32_t sum, equal, doubled, max;
+  out.pop(sum);
+  out.pop(equal);
+  out.pop(doubled);
+  out.pop(max);
+  fmt::print("sum: {} equal: {} doubled: {} max: {:c} min: ", sum, equal,
+             doubled, char(max));
+  for (uint32_t c; out.pop(c);)
+    fmt::print("{}", char(c));
+  fmt::print("\n");
+  auto status = run.execute();
+  fmt::print("status: {} code: {}\n", int(status), int(run.trap().code));
+}
+
+int main() {
+  fmt::print("lanes: {}\n", tri::lane_implementation());
+  print(tri::assemble(data, text));
+  print(tri::assemble(data, text, true));
+}
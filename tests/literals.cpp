@@ -0,0 +1,40 @@
+#include "fmt/format.h"
+#include "tri/asm.hpp"
+#include <stdexcept>
+#include <utility>
+
+int main() {
+  auto text = "mov 0x30 r0\n"         // rotated narrow literal
+              "out r0\n"              // 0
+              "addi r0 0x100000 r1\n" // rotated narrow literal
+              "subi r1 0x100000 r1\n"
+              "addi r1 1 r1\n"
+              "out r1\n"              // 1
+              "mov 123456 r2\n"       // pooled, becomes an ldc
+              "subi r2 123406 r3\n"   // pooled, loaded into r3
+              "out r3\n"              // 2
+              "addi r3 123406 r4\n"   // same pool entry, loaded into r4
+              "subi r4 r2 r4\n"
+              "addi r4 r3 r4\n"
+              "addi r4 1 r4\n"
+              "out r4\n"              // 3
+              "mov 10 r0\n"
+              "out r0\n";
+  auto e = tri::assemble("", text);
+  auto stats = e.literals;
+  auto run = tri::Interpreter(std::move(e));
+  run.execute();
+  fmt::print("{}", run.port().out.read_text());
+  fmt::print("direct: {} rotated: {} pooled: {}\n", stats.direct,
+             stats.rotated, stats.pooled);
+
+  // a pooled literal has nowhere to go when the destination is a literal
+  for (auto bad : {"mov 123456 5\n", "alloc 123456 5\n"}) {
+    try {
+      tri::assemble("", bad);
+    } catch (const std::runtime_error &e) {
+      fmt::print("{}", bad);
+      fmt::print("  {}\n", e.what());
+    }
+  }
+}
@@ -0,0 +1,84 @@
+#include "fmt/format.h"
+#include "tri/asm.hpp"
+#include <string>
+#include <utility>
+
+// runs a program with and without the optimizer, output should not change
+void compare(const char *name, const char *data, const char *text) {
+  for (bool optimize : {false, true}) {
+    auto e = tri::assemble(data, text, optimize);
+    auto stats = e.optimized;
+    auto run = tri::Interpreter(std::move(e));
+    std::string output;
+    auto &port = run.port();
+    for (uint32_t input = 0; !port.in.full(); ++input)
+      port.in.push(input % 3);
+    run.execute();
+    run.execute();
+    auto &out = port.out;
+    for (auto words = out.peek(); !words.empty(); words = out.peek()) {
+      output.append(words.begin(), words.end());
+      out.consume(words.size());
+    }
+    fmt::print("{} -O{}: {:?}", name, int(optimize), output);
+    if (optimize)
+      fmt::print(" | {} -> {} instructions, folded: {} propagated: {} "
+                 "dead: {} unreachable: {} threaded: {}",
+                 stats.before, stats.after, stats.folded, stats.propagated,
+                 stats.dead, stats.unreachable, stats.threaded);
+    fmt::print("\n");
+  }
+}
+
+int main() {
+  compare("constants", ".int base 0x30",
+          "mov 5 r0\n"
+          "mov r0 r1\n"
+          "addi r1 3 r2\n" // folds to 8
+          "addi r2 base r3\n"
+          "out r3\n"
+          "mov 7 r4\n" // never read
+          "jmp @first\n"
+          "mov 1 r5\n" // unreachable
+          "@first\n"
+          "jmp @second\n"
+          "@second\n"
+          "mov 0 r6\n"
+          "jez r6 @third\n" // always taken
+          "out r6\n"
+          "@third\n"
+          "mov 10 r0\n"
+          "out r0\n"
+          "hlt\n"
+          "out r3\n"); // reached by the second execute()
+
+  compare("loop", "",
+          "mov 4 r0\n"
+          "@loop\n"
+          "in r1\n"
+          "mov r1 r2\n"
+          "addi r2 0x30 r3\n"
+          "out r3\n"
+          "subi r0 1 r0\n"
+          "jnz r0 @trampoline\n"
+          "mov 10 r3\n"
+          "out r3\n"
+          "hlt\n"
+          "hlt\n"
+          "@trampoline\n"
+          "jmp @loop\n");
+
+  compare("calls", "",
+          "mov 0x30 r0\n"
+          "call @print\n"
+          "addi r0 1 r0\n"
+          "call @print\n"
+          "mov 10 r0\n"
+          "out r0\n"
+          "hlt\n"
+          "hlt\n"
+          "@print\n"
+          "mov r0 r1\n"
+          "out r1\n"
+          "jmp rp\n");
+}
@@ -0,0 +1,46 @@
+#include "fmt/format.h"
+#include "tri/asm.hpp"
+#include <cstdint>
+
+// keeps a list of two word nodes and drops a four word scratch object every
+// iteration. The budget makes alloc collect as it goes.
+constexpr auto leak = "mov 0 r2\n"
+                      "mov 0x1000 r5\n"
+                      "@loop\n"
+                      "alloc 4 r1\n"
+                      "alloc 2 r3\n"
+                      "store r2 r3\n"
+                      "mov r3 r2\n"
+                      "subi r5 1 r5\n"
+                      "jnz r5 @loop\n"
+                      "hlt\n";
+
+int main() {
+  // every object sampled, so the numbers are exact
+  auto run = tri::Interpreter(tri::assemble("", leak));
+  run.set_limits({.heap_words = 0x2400});
+  int cleans = 0;
+  run.profile_heap(tri::HeapProfiling{
+      .sample_words = 1,
+      .on_clean = [&](const tri::HeapProfile &) { ++cleans; }});
+  auto status = run.execute();
+  fmt::print("status: {} code: {} cleans: {}\n", int(status),
+             int(run.trap().code), cleans);
+  run.clean();
+  fmt::print("{}", run.heap_profile().dump());
+
+  // sampled, the estimate should land near what is really there
+  run = tri::Interpreter(tri::assemble("", leak));
+  run.profile_heap(tri::HeapProfiling{.sample_words = 16});
+  run.execute();
+  run.clean();
+  auto &profile = run.heap_profile();
+  fmt::print("sampled: ~{:.0f} live words, {} really\n", profile.live_words,
+             run.mem_consumption());
+
+  // not profiling leaves the profile empty
+  run = tri::Interpreter(tri::assemble("", leak));
+  run.execute();
+  run.clean();
+  fmt::print("off: {} sites\n", run.heap_profile().sites.size());
+}
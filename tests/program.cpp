@@ -0,0 +1,41 @@
+#include "fmt/format.h"
+#include "tri/asm.hpp"
+#include "tri/program.hpp"
+#include <string>
+#include <utility>
+
+#define DATA                                                                   \
+  ".ascii str 'compile time\\n'\n"                                             \
+  ".int strlen 13"
+#define TEXT                                                                   \
+  "mov 0 r0\n"                                                                 \
+  "@loop\n"                                                                    \
+  "load r0 r1\n"                                                               \
+  "out r1\n"                                                                   \
+  "addi r0 1 r0\n"                                                             \
+  "subi strlen r0 r2\n"                                                        \
+  "jnz r2 @loop\n"                                                             \
+  "mov 100000 r3\n" // pooled literal
+
+constexpr auto &echo = tri::program<TEXT, DATA>;
+static_assert(echo.text.size() == 8);
+static_assert(echo.data.size() == 15);
+static_assert(echo.literals.pooled == 1);
+
+std::string output(tri::Executable &&e) {
+  std::string result;
+  auto run = tri::Interpreter(std::move(e));
+  run.execute();
+  auto &out = run.port().out;
+  for (auto words = out.peek(); !words.empty(); words = out.peek()) {
+    result.append(words.begin(), words.end());
+    out.consume(words.size());
+  }
+  return result;
+}
+
+int main() {
+  auto compiled = output(echo.executable());
+  auto runtime = output(tri::assemble(DATA, TEXT));
+  fmt::print("{}same as runtime: {}\n", compiled, compiled == runtime);
+}
@@ -0,0 +1,110 @@
+#include "fmt/format.h"
+#include "tri/asm.hpp"
+#include <chrono>
+#include <utility>
+
+// only the newest object is reachable, so clean() makes room for the next
+// one until two of them are held at once
+constexpr auto churn = "mov 0 r2\n"
+                       "@loop\n"
+                       "alloc 40 r1\n"
+                       "addi r2 1 r2\n"
+                       "subi r2 10 r3\n"
+                       "jnz r3 @loop\n"
+                       "out r2\n"
+                       "alloc 40 r4\n"
+                       "alloc 40 r5\n";
+
+constexpr auto deep = "mov 0x100 r1\n"
+                      "store r1 r1\n";
+
+constexpr auto many = "alloc 1 r1\n"
+                      "alloc 1 r2\n"
+                      "alloc 1 r3\n"
+                      "alloc 1 r4\n";
+
+// the size is also the destination, which a failed alloc must leave alone
+// for the retry
+constexpr auto retry = "mov 0x200 r1\n"
+                       "alloc r1 r1\n"
+                       "hlt\n";
+
+// the store traps with a pointer to the first object, which is garbage by
+// the time the alloc over the budget traps. The handler skips both
+constexpr auto stale = "alloc 1 r1\n"
+                       "alloc 1 r2\n"
+                       "addi r2 5 r3\n"
+                       "store r1 r3\n"
+                       "mov 0 r1\n"
+                       "alloc 0x200 r4\n"
+                       "hlt\n"
+                       "@skip\n"
+                       "addi rp 1 rp\n"
+                       "jmp rp\n";
+
+// a size and a stack address from the host, past what the default budgets
+// allow in either layout
+constexpr auto huge = "in r1\n"
+                      "alloc r1 r2\n";
+
+constexpr auto far = "in r1\n"
+                     "store r1 r1\n";
+
+// none of these are ever collected
+constexpr auto garbage = "mov 0x5000 r2\n"
+                         "@loop\n"
+                         "alloc 4 r1\n"
+                         "subi r2 1 r2\n"
+                         "jnz r2 @loop\n";
+
+void report(const char *name, tri::Interpreter &run) {
+  auto status = run.execute();
+  fmt::print("{}: status: {} code: {} ip: {} memory: {}\n", name, int(status),
+             int(run.trap().code), run.trap().ip, run.mem_consumption());
+}
+
+int main() {
+  auto run = tri::Interpreter(tri::assemble("", churn));
+  run.set_limits({.heap_words = 100});
+  report("heap words", run);
+  uint32_t loops = 0;
+  run.port().out.pop(loops);
+  fmt::print("loops: {}\n", loops);
+
+  run = tri::Interpreter(tri::assemble("", deep));
+  run.set_limits({.stack_words = 64});
+  report("stack words", run);
+
+  run = tri::Interpreter(tri::assemble("", many));
+  run.set_limits({.objects = 3});
+  report("objects", run);
+
+  run = tri::Interpreter(tri::assemble("", retry));
+  run.set_limits({.heap_words = 0x100});
+  report("retry", run);
+  run.set_limits({});
+  report("retried", run);
+
+  run = tri::Interpreter(tri::assemble("", stale));
+  run.set_limits({.heap_words = 0x100});
+  run.trap_handler("@skip");
+  report("stale", run);
+  run.clean();
+  fmt::print("after clean: {}\n", run.mem_consumption());
+
+  for (auto [name, text] :
+       {std::pair{"default object", huge}, std::pair{"default stack", far}}) {
+    run = tri::Interpreter(tri::assemble("", text));
+    run.port().in.push(tri::Limits::object_words + 1);
+    report(name, run);
+  }
+
+  // releasing the arena frees every object at once
+  auto big = tri::Interpreter(tri::assemble("", garbage));
+  report("garbage", big);
+  auto begin = std::chrono::steady_clock::now();
+  big = tri::Interpreter(tri::assemble("", ""));
+  auto elapsed = std::chrono::steady_clock::now() - begin;
+  fmt::print("released in {:.1f} us\n",
+             std::chrono::duration<double, std::micro>(elapsed).count());
+}
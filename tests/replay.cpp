@@ -0,0 +1,61 @@
+#include "fmt/format.h"
+#include "tri/asm.hpp"
+#include <cstdint>
+#include <utility>
+
+// outputs the running sum of its input until it reads a 0
+constexpr auto text = "mov 0 r2\n"
+                      "@loop\n"
+                      "in r1\n"
+                      "jez r1 @done\n"
+                      "addi r2 r1 r2\n"
+                      "out r2\n"
+                      "jmp @loop\n"
+                      "@done\n"
+                      "hlt\n";
+
+constexpr uint32_t count = 4000;
+
+int main() {
+  auto program = tri::Program(tri::assemble("", text));
+
+  // the host feeds input a few words at a time and drains output whenever
+  // the guest stops
+  auto live = tri::Interpreter(program);
+  tri::IoLog log;
+  live.record(&log);
+  uint32_t fed = 0;
+  while (true) {
+    for (int n = 0; n != 7 && fed != count; ++n)
+      live.port().in.push(++fed % count);
+    auto status = live.execute();
+    live.port().out.consume(live.port().out.size());
+    if (status != tri::Status::suspended)
+      break;
+  }
+  auto bytes = log.encode();
+  fmt::print("events: {} bytes: {} instructions: {}\n", log.events().size(),
+             bytes.size(), live.retired_instructions());
+
+  // the same run with and without traces, and with nothing from the host
+  auto decoded = tri::IoLog::decode(bytes);
+  for (bool tracing : {true, false}) {
+    auto vm = tri::Interpreter(program);
+    vm.enable_tracing(tracing);
+    auto report = vm.replay(decoded);
+    fmt::print("tracing: {} status: {} matched: {} diverged: {}\n", tracing,
+               int(report.status), report.matched, report.diverged);
+  }
+
+  // a changed input shows up in the output right after it
+  tri::IoLog changed;
+  for (auto e : decoded.events()) {
+    if (!e.output && e.value == 100)
+      e.value = 101;
+    changed.push(e);
+  }
+  auto vm = tri::Interpreter(program);
+  auto report = vm.replay(changed);
+  fmt::print("changed: status: {} matched: {} diverged: {}\n",
+             int(report.status), report.matched, report.diverged);
+}
@@ -0,0 +1,75 @@
+#include "fmt/format.h"
+#include "tri/asm.hpp"
+#include <cstdint>
+
+// a guest vector that doubles its capacity whenever it is full, and a second
+// pointer to it taken before it ever grew. Sums what it pushed through that
+// pointer once it holds 1024 words.
+constexpr auto vector = "alloc 1 r1\n"
+                        "mov r1 r6\n"
+                        "mov 0 r2\n"
+                        "mov 1 r3\n"
+                        "@push\n"
+                        "subi r2 r3 r4\n"
+                        "jnz r4 @room\n"
+                        "addi r3 r3 r3\n"
+                        "realloc r1 r3 r1\n"
+                        "@room\n"
+                        "addi r1 r2 r4\n"
+                        "store r2 r4\n"
+                        "addi r2 1 r2\n"
+                        "subi r2 0x400 r4\n"
+                        "jnz r4 @push\n"
+                        "mov 0 r5\n"
+                        "@sum\n"
+                        "subi r2 1 r2\n"
+                        "addi r6 r2 r4\n"
+                        "load r4 r4\n"
+                        "addi r5 r4 r5\n"
+                        "jnz r2 @sum\n"
+                        "out r5\n"
+                        "hlt\n";
+
+// a pointer past the end of a shrunk object
+constexpr auto shrink = "alloc 0x10 r1\n"
+                        "addi r1 12 r2\n"
+                        "realloc r2 4 r3\n"
+                        "subi r2 r3 r4\n"
+                        "out r4\n"
+                        "load r2 r5\n";
+
+constexpr auto grow = "alloc 0x40 r1\n"
+                      "realloc r1 0x80 r1\n";
+
+int main() {
+  // realloc resizes the one object in place, so it never needs a second one
+  // or more words than the vector ends up holding
+  auto run = tri::Interpreter(tri::assemble("", vector));
+  run.set_limits({.heap_words = 0x400, .objects = 1, .collect = false});
+  auto status = run.execute();
+  uint32_t sum = 0;
+  run.port().out.pop(sum);
+  fmt::print("vector: halted: {} sum through the first pointer: {} "
+             "expected {} words: {}\n",
+             status == tri::Status::halted, sum, 0x3ff * 0x400 / 2,
+             run.mem_consumption());
+  // the object was resized, never replaced, so there is nothing to collect
+  run.clean();
+  fmt::print("after clean: {}\n", run.mem_consumption());
+
+  run = tri::Interpreter(tri::assemble("", shrink));
+  run.execute();
+  uint32_t offset = 0;
+  run.port().out.pop(offset);
+  fmt::print("shrink: offset {} into {} words, load traps: {} at ip {}\n",
+             offset, run.mem_consumption(),
+             run.trap().code == tri::TrapCode::invalid_deref, run.trap().ip);
+
+  // 64 words growing to 128 is over 100, and the object keeps its old size
+  run = tri::Interpreter(tri::assemble("", grow));
+  run.set_limits({.heap_words = 100});
+  run.execute();
+  fmt::print("grow past quota: traps: {} at ip {} words: {}\n",
+             run.trap().code == tri::TrapCode::memory_quota, run.trap().ip,
+             run.mem_consumption());
+}
@@ -0,0 +1,78 @@
+#include "fmt/format.h"
+#include "tri/asm.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+// the first run builds a list holding 1..20, every run after that adds its
+// input to each value and outputs the sum
+constexpr auto text = "mov 0 r1\n"
+                      "mov 20 r2\n"
+                      "@build\n"
+                      "alloc 2 r0\n"
+                      "store r2 r0\n"
+                      "addi r0 1 r3\n"
+                      "store r1 r3\n"
+                      "mov r0 r1\n"
+                      "subi r2 1 r2\n"
+                      "jnz r2 @build\n"
+                      "hlt\n"
+                      "mov r1 r0\n"
+                      "mov 0 r5\n"
+                      "in r4\n"
+                      "@walk\n"
+                      "load r0 r2\n"
+                      "addi r2 r4 r2\n"
+                      "store r2 r0\n"
+                      "addi r5 r2 r5\n"
+                      "addi r0 1 r3\n"
+                      "load r3 r0\n"
+                      "jnz r0 @walk\n"
+                      "out r5\n"
+                      "hlt\n";
+
+uint32_t sum(tri::Interpreter &run, uint32_t add) {
+  run.port().in.push(add);
+  run.execute();
+  uint32_t result = 0;
+  run.port().out.pop(result);
+  return result;
+}
+
+int main() {
+  auto warm = tri::Interpreter(tri::assemble("", text));
+  warm.execute();
+  auto snapshot = warm.snapshot();
+  fmt::print("snapshot: {} bytes, words: {}\n", snapshot.size(),
+             warm.mem_consumption());
+
+  auto restored = tri::Interpreter::restore(snapshot);
+  fmt::print("restored: {}\n", sum(restored, 0));
+
+  // each fork only copies the list nodes it writes to, and the warm one
+  // never sees what they wrote
+  std::vector<tri::Interpreter> forks;
+  for (int i = 0; i != 100; ++i)
+    forks.push_back(warm.fork());
+  bool correct = true;
+  for (uint32_t i = 0; i != forks.size(); ++i)
+    correct &= sum(forks[i], i) == 210 + 20 * i;
+  fmt::print("forks: {} correct: {}\n", forks.size(), correct);
+  fmt::print("warm: {}\n", sum(warm, 0));
+
+  // r5 pointing at an object that was never allocated is refused. Registers
+  // follow the magic, and a pointer is the tag bit over its object number.
+  auto dangling = snapshot;
+  auto r5 = 4 + (size_t(tri::Register::r5) - 1) * sizeof(tri::Word);
+  auto bits = uint64_t(1) << (sizeof(tri::Word) * 8 - 1) | 0xfff;
+  for (size_t i = 0; i != sizeof(tri::Word); ++i)
+    dangling[r5 + i] = std::byte(bits >> i * 8);
+  try {
+    tri::Interpreter::restore(dangling);
+    fmt::print("dangling: restored\n");
+  } catch (const std::runtime_error &e) {
+    fmt::print("dangling: {}\n", e.what());
+  }
+}
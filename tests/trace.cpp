@@ -0,0 +1,82 @@
+#include "fmt/format.h"
+#include "tri/asm.hpp"
+#include <chrono>
+#include <cstdint>
+#include <vector>
+
+// the sum loop gets a trace, the branch on r5 goes the other way every
+// other iteration so half of them leave it. fill is hot with r6 on the
+// stack first, so the trace it gets keeps bailing out once r6 is a pointer
+// until it's dropped and recorded again. The last loop pushes and pops,
+// which trace as generic steps.
+constexpr auto text = "mov 0 r1\n"
+                      "mov 0 r2\n"
+                      "mov 0 r4\n"
+                      "mov 0 r5\n"
+                      "@loop\n"
+                      "addi r1 1 r1\n"
+                      "addi r2 r1 r2\n"
+                      "subi 1 r5 r5\n"
+                      "jez r5 @even\n"
+                      "addi r4 1 r4\n"
+                      "@even\n"
+                      "subi r1 1000 r3\n"
+                      "jnz r3 @loop\n"
+                      "out r2\n"
+                      "out r4\n"
+                      "mov 100 r6\n"
+                      "call @fill\n"
+                      "alloc 200 r6\n"
+                      "call @fill\n"
+                      "subi r6 1 r6\n"
+                      "load r6 r8\n"
+                      "out r8\n"
+                      "mov 100 r1\n"
+                      "mov 0 r4\n"
+                      "@stack\n"
+                      "push r1\n"
+                      "pop r3\n"
+                      "addi r4 r3 r4\n"
+                      "subi r1 1 r1\n"
+                      "jnz r1 @stack\n"
+                      "out r4\n"
+                      "hlt\n"
+                      "@fill\n"
+                      "mov 200 r7\n"
+                      "@fillloop\n"
+                      "store r7 r6\n"
+                      "addi r6 1 r6\n"
+                      "subi r7 1 r7\n"
+                      "jnz r7 @fillloop\n"
+                      "ret\n";
+
+std::vector<uint32_t> collect(tri::Interpreter &run) {
+  std::vector<uint32_t> words;
+  for (uint32_t w; run.port().out.pop(w);)
+    words.push_back(w);
+  return words;
+}
+
+int main() {
+  auto plain = tri::Interpreter(tri::assemble("", text));
+  plain.enable_tracing(false);
+  plain.execute();
+  auto expected = collect(plain);
+
+  auto run = tri::Interpreter(tri::assemble("", text));
+  run.enable_tracing(true, true);
+  auto status = run.execute();
+  auto words = collect(run);
+  fmt::print("status: {} output: {} same as untraced: {}\n", int(status),
+             fmt::join(words, " "), words == expected);
+  auto &stats = run.trace_stats();
+  fmt::print("recorded: {} aborted: {} entered: {} loop exits: {} "
+             "side exits: {} discarded: {} instructions: {}\n",
+             stats.recorded, stats.aborted, stats.entered, stats.loop_exits,
+             stats.side_exits, stats.discarded, stats.instructions);
+  // every instruction a trace ran is counted once, as the interpreter would
+  fmt::print("retired: {} same as untraced: {}\n", run.retired_instructions(),
+             run.retired_instructions() == plain.retired_instructions());
+  fmt::print("{:.1f} us in traces\n",
+             std::chrono::duration<double, std::micro>(stats.time).count());
+}
@@ -0,0 +1,55 @@
+#include "fmt/format.h"
+#include "tri/asm.hpp"
+
+// adding two pointers traps, first reported to the host then to a handler
+// that prints the trap code and skips the faulting instruction
+constexpr auto text = "alloc 4 r1\n"
+                      "alloc 4 r2\n"
+                      "addi r1 r2 r3\n"
+                      "mov 0x6b r0\n"
+                      "out r0\n"
+                      "jmp @end\n"
+                      "@fault\n"
+                      "addi r0 0x30 r0\n"
+                      "out r0\n"
+                      "addi rp 1 rp\n"
+                      "jmp rp\n"
+                      "@end\n";
+
+// the handler traps too, which goes to the host instead of the handler
+constexpr auto broken = "alloc 1 r5\n"
+                        "addi r5 r5 r6\n"
+                        "hlt\n"
+                        "@handler\n"
+                        "mov 0 r7\n"
+                        "addi r5 r5 r6\n"
+                        "ret\n";
+
+int main() {
+  auto host = tri::Interpreter(tri::assemble("", text));
+  auto status = host.execute();
+  fmt::print("{}", host.port().out.read_text());
+  auto &trap = host.trap();
+  fmt::print("status: {} code: {} ip: {} operands: {} {}\n", int(status),
+             int(trap.code), trap.ip, trap.a.alloc.number,
+             trap.b.alloc.number);
+
+  auto guest = tri::Interpreter(tri::assemble("", text));
+  fmt::print("handler: {}\n", guest.trap_handler("@fault"));
+  status = guest.execute();
+  fmt::print("{}", guest.port().out.read_text());
+  fmt::print("\nstatus: {}\n", int(status));
+
+  // the optimizer would drop @fault, nothing jumps to it
+  auto optimized = tri::Interpreter(tri::assemble("", text, true));
+  fmt::print("optimized handler: {}\n", optimized.trap_handler("@fault"));
+  status = optimized.execute();
+  fmt::print("status: {} code: {}\n", int(status),
+             int(optimized.trap().code));
+
+  auto looping = tri::Interpreter(tri::assemble("", broken));
+  looping.trap_handler("@handler");
+  status = looping.execute();
+  fmt::print("broken handler: status: {} code: {} ip: {}\n", int(status),
+             int(looping.trap().code), looping.trap().ip);
+}
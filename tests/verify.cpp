@@ -0,0 +1,23 @@
+#include "fmt/format.h"
+#include "tri/asm.hpp"
+#include <utility>
+
+void run(const char *name, const char *text) {
+  auto run = tri::Interpreter(tri::assemble("", text));
+  fmt::print("{}: verified: {} ", name, run.verified());
+  if (run.execute() == tri::Status::halted)
+    fmt::print("ok\n");
+  else
+    fmt::print("trap {} at {}\n", int(run.trap().code), run.trap().ip);
+}
+
+int main() {
+  run("loop", "mov 3 r0\n"
+              "@loop\n"
+              "subi r0 1 r0\n"
+              "jnz r0 @loop\n");
+  run("register jump", "mov 12 r0\n"
+                       "jmp r0\n");
+  run("literal jump", "jmp 12\n");
+  run("writes ip", "mov 12 ip\n");
+}
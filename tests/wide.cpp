@@ -0,0 +1,44 @@
+#include "fmt/format.h"
+#include "tri/asm.hpp"
+#include <cstddef>
+#include <cstdint>
+
+// things only wide words can reach, built against triasm-wide
+
+// A list of 2^18 one word nodes, more than 32 bit words can number, then
+// scratch objects that only fit once a collection has run. Marking the
+// list is as deep as it is long.
+constexpr auto list = "mov 0 r2\n"
+                      "mov 0x40000 r5\n"
+                      "@list\n"
+                      "alloc 1 r1\n"
+                      "store r2 r1\n"
+                      "mov r1 r2\n"
+                      "subi r5 1 r5\n"
+                      "jnz r5 @list\n"
+                      "mov 4 r5\n"
+                      "@scratch\n"
+                      "alloc 0x8000 r1\n"
+                      "subi r5 1 r5\n"
+                      "jnz r5 @scratch\n"
+                      "hlt\n";
+
+int main() {
+  auto run = tri::Interpreter(tri::assemble("", list));
+  run.set_limits({.heap_words = 0x40000 + 0x10000});
+  auto status = run.execute();
+  fmt::print("list: status: {} code: {} memory: {}\n", int(status),
+             int(run.trap().code), run.mem_consumption());
+  run.clean();
+  fmt::print("after clean: {}\n", run.mem_consumption());
+
+  // ip is the first word after the magic, a snapshot can put it past 2^32
+  auto snapshot = tri::Interpreter(tri::assemble("", "hlt\n")).snapshot();
+  uint64_t far = (uint64_t(1) << 32) + 1;
+  for (int i = 0; i != 8; ++i)
+    snapshot[4 + i] = std::byte(far >> i * 8);
+  auto lost = tri::Interpreter::restore(snapshot);
+  status = lost.execute();
+  fmt::print("far ip: status: {} code: {} ip: {:#x}\n", int(status),
+             int(lost.trap().code), lost.trap().ip);
+}